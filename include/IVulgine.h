@@ -20,6 +20,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <functional>
 #include "IVulgineScene.h"
 
@@ -38,6 +39,13 @@ namespace Vulgine {
         bool enableVulkanValidationLayers = false;
         bool fullscreen = false;
         bool vsync = true;
+        bool reuseCommandBuffers = true;
+        bool autoInstancing = true; // draw static meshes sharing vertices and materials as instances of one draw
+        bool indirectDraws = true; // issue draws sharing pipeline and buffers by one indirect call, if device supports multiDrawIndirect and drawIndirectFirstInstance
+        uint32_t recordingThreads = 0; // 0 means one per hardware thread
+        bool asyncPipelineCompilation = true;
+        std::string pipelineCachePath = "pipeline_cache.bin"; // empty string disables persistent pipeline cache
+        bool headless = false; // render to engine-owned targets without window and swap chain, see Vulgine::onFrame
         std::string applicationName = "VulGineApp";
 
         void reset();
@@ -159,14 +167,105 @@ namespace Vulgine {
 
         std::function<void(void)> onCycle = [](){};
 
+        /**
+         *
+         * Frame rendered in headless mode. Pixels are tightly packed rows of 8-bit RGBA texels,
+         * valid only within onFrame call scope.
+         *
+         */
+
+        struct HeadlessFrame{
+            const void* pixels = nullptr;
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint64_t index = 0;     /** sequential number of the frame, starting from 0 */
+        };
+
+        /**
+         *
+         * Called in headless mode once GPU has finished rendering a frame. Frames are delivered in
+         * order, framesInFlight cycles late. Frames still in flight are delivered on Terminate().
+         *
+         */
+
+        std::function<void(HeadlessFrame const&)> onFrame = [](HeadlessFrame const&){};
+
         /**
          *
          * Main render loop. General use pattern: while(VulGine->cycle());
          *
          * @return true if quit condition is satisfied, false otherwise.
+         *
+         * @note In headless mode there is no quit condition, so application stops calling cycle() itself.
          */
         virtual bool cycle() = 0;
         virtual double lastFrameTime() const = 0;
+
+        /**
+         *
+         * Writes GPU timings of render passes and subpasses of last frames as Chrome trace event JSON
+         * (may be opened in chrome://tracing or Perfetto).
+         *
+         * @return false if GPU profiler is unsupported or file could not be written.
+         */
+        virtual bool exportGPUTrace(const char* filename) = 0;
+
+        /**
+         *
+         * Writes CPU zones of engine threads recorded so far as Chrome trace event JSON.
+         *
+         * @return false if CPU profiler is compiled out or file could not be written.
+         */
+        virtual bool exportCPUTrace(const char* filename) = 0;
+
+        /**
+         *
+         * GPU memory taken by the engine. Heap budget and usage are reported by driver if it supports
+         * VK_EXT_memory_budget, otherwise they are estimated from engine allocations and heap size.
+         *
+         */
+
+        struct MemoryStatistics{
+            struct Heap{
+                uint64_t size = 0;
+                uint64_t budget = 0;            /** memory engine may use without hurting performance */
+                uint64_t usage = 0;             /** memory used by the process */
+                uint64_t blockBytes = 0;        /** device memory allocated by engine */
+                uint64_t allocationBytes = 0;   /** part of blocks taken by resources */
+                bool deviceLocal = false;
+            };
+
+            std::vector<Heap> heaps;
+            bool driverBudget = false;          /** budget and usage come from VK_EXT_memory_budget */
+
+            // bytes taken by objects of each kind
+
+            uint64_t meshBytes = 0;             /** mesh data within geometry pools plus dynamic buffers */
+            uint64_t geometryPoolBytes = 0;     /** vertex and index pools including unused space */
+            uint64_t imageBytes = 0;
+            uint64_t uniformBufferBytes = 0;
+            uint64_t attachmentBytes = 0;       /** render pass attachments and transient heaps */
+            uint64_t stagingBytes = 0;
+        };
+
+        virtual MemoryStatistics memoryStatistics() = 0;
+
+        /**
+         *
+         * Writes detailed allocator state (heaps, memory types, blocks and allocations) as JSON.
+         *
+         * @return false if file could not be written.
+         */
+        virtual bool exportMemoryStatistics(const char* filename) = 0;
+
+        /**
+         *
+         * Starts compacting memory of static uniform buffers and images. They are moved gradually, a few
+         * megabytes per frame, during following frames. Each of these frames waits for GPU to finish the moves.
+         *
+         */
+        virtual void defragmentMemory() = 0;
+
         friend bool Init();
         friend void Terminate();
     };
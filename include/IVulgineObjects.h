@@ -407,6 +407,16 @@ namespace Vulgine{
 
         virtual void updateInstanceBuffer() = 0;
 
+        /** Pushes count vertices starting from first to video memory. Vertex count may change too,
+         *  buffers grow with spare capacity. Non-dynamic vertices are updated as a whole */
+
+        virtual void updateVertexRange(uint32_t first, uint32_t count) = 0;
+
+        /** Pushes count instances starting from first to video memory. Instance count may change too,
+         *  buffers grow with spare capacity. Non-dynamic instances are updated as a whole */
+
+        virtual void updateInstanceRange(uint32_t first, uint32_t count) = 0;
+
 
     };
 
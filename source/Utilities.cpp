@@ -16,6 +16,18 @@ namespace Vulgine{
                 *output << log << std::endl;
             }
         }
+        std::string escapeJSON(std::string const& str){
+            std::string ret;
+            ret.reserve(str.size());
+            for(char c: str){
+                if(c == '"' || c == '\\')
+                    ret.push_back('\\');
+                if(static_cast<unsigned char>(c) < 0x20)
+                    continue;
+                ret.push_back(c);
+            }
+            return ret;
+        }
         void ExitFatal(int err_code, std::string const& err){
             errs("FATAL: " + err);
             exit(err_code);
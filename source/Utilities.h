@@ -4,6 +4,7 @@
 
 #ifndef VULGINE_UTILITIES_H
 #define VULGINE_UTILITIES_H
+#include <cassert>
 #include <string>
 #include <ostream>
 #include <vulkan/vulkan.h>
@@ -56,6 +57,9 @@ namespace Vulgine{
         };
 
         std::string errorString(VkResult errorCode);
+
+        /** escapes string to be put in JSON string literal. Control characters are dropped */
+        std::string escapeJSON(std::string const& str);
         void ExitFatal(int err_code = -1, std::string const& err = "program aborted");
     }
     extern Utilities::Errs errs;
@@ -12,6 +12,12 @@
 #include "vulkan/VulkanInitializers.hpp"
 #include "imgui/imgui.h"
 #include <thread>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <iterator>
 
 namespace {
     Vulgine::VulgineImpl impl;
@@ -52,6 +58,7 @@ namespace Vulgine{
 #endif
             logger("Loaded compatible VulGine version: " + getStringVersion());
 
+#ifndef VULGINE_NO_WINDOW
             // checking if loaded GLFW library has compatible version
 
 
@@ -67,6 +74,7 @@ namespace Vulgine{
                 return false;
             }
             logger("Proper GLFW version loaded: " + std::string(glfwGetVersionString()));
+#endif
 
             ObjectImpl::fillTypeNameTable();
 
@@ -109,10 +117,14 @@ namespace Vulgine{
 
     bool VulgineImpl::cycle() {
 
-        if (glfwWindowShouldClose(window.instance())) {
-            VK_CHECK_RESULT(vkQueueWaitIdle(queue));
+        VULGINE_PROFILE_ZONE("cycle");
+
+#ifndef VULGINE_NO_WINDOW
+        if (!headless && glfwWindowShouldClose(window.instance())) {
+            timeline.waitIdle();
             return false;
         }
+#endif
 
         timeMarkers.tEnd = std::chrono::high_resolution_clock::now();
         auto frameTime = std::chrono::duration<double, std::milli>(timeMarkers.tEnd - timeMarkers.tStart).count();
@@ -124,20 +136,57 @@ namespace Vulgine{
 
         keyboardState.keysPressed.clear();
 
-        glfwPollEvents();
-
         MeshImpl::clearHighlight();
 
+        // there is no input and nobody to show ui to in headless mode
+
+        if(headless){
+            if(prepared)
+                renderFrame();
+            return true;
+        }
+
+#ifndef VULGINE_NO_WINDOW
+        glfwPollEvents();
+
         updateGUI();
 
         if (prepared && !glfwGetWindowAttrib(window.instance(), GLFW_ICONIFIED))
             renderFrame();
+#endif
 
         return true;
     }
 
     void VulgineImpl::terminate() {
 
+        vkDeviceWaitIdle(device->logicalDevice);
+
+        // hand out frames still in flight, oldest first
+
+        if(headless)
+            for(int i = 0; i < settings.framesInFlight; ++i)
+                deliverHeadlessFrame((currentFrame + i) % settings.framesInFlight);
+
+        // every object engine holds is released first, so it's retired along with the ones application released
+
+        renderPassLine.clear();
+        onscreenRenderPass.reset();
+        renderGraph.release();
+        highlightMaterial.reset();
+        gui.releaseObjects();
+
+        pendingSwaps.clear();
+
+        // GPU is idle, so every retired object may be destroyed now. Objects released by destruction of
+        // retired ones are retired meanwhile and destroyed by the same call
+
+        vkDeviceWaitIdle(device->logicalDevice);
+
+        destroyRetired(UINT64_MAX);
+
+        dirtyUniformBuffers.clear();
+
         scenes.clear();
         materials.clear();
         images.clear();
@@ -145,20 +194,29 @@ namespace Vulgine{
         samplers.clear();
         geometries.clear();
         meshes.clear();
-        renderPassLine.clear();
-        onscreenRenderPass.reset();
-        highlightMaterial.reset();
 
-
-        destroyShaders();
+        recordingThreads.stop();
 
         pipelineMap.clear();
 
+        pipelineMap.compiler.stop();
+
+        destroyShaders();
+
         debug::freeDebugCallback(instance);
 
+        vertexPool.destroy();
+        indexPool.destroy();
+        uniformRing.destroy();
+
+        uploader.destroy();
+
         destroySyncPrimitives();
 
-        swapChain.cleanup();
+        if(headless)
+            destroyHeadlessTargets();
+        else
+            swapChain.cleanup();
 
         destroyCommandBuffers();
 
@@ -168,24 +226,101 @@ namespace Vulgine{
 
         destroyDescriptorPools();
 
+        savePipelineCache();
+
         vkDestroyPipelineCache(device->logicalDevice, pipelineCache, nullptr);
 
         vkDestroyCommandPool(device->logicalDevice, cmdPool, nullptr);
 
+        // object retired after the drain would be destroyed after pools and allocator it was allocated from
+
+        assert(retiredObjects.empty() && "Object was retired after engine resources were destroyed");
+
         vmaDestroyAllocator(allocator);
 
         delete device;
         vkDestroyInstance(instance, nullptr);
 
+        if(headless)
+            return;
+
         window.terminate();
 
+#ifndef VULGINE_NO_WINDOW
         glfwTerminate();
+#endif
     }
 
     void VulgineImpl::destroyCommandBuffers()
     {
         vkFreeCommandBuffers(device->logicalDevice, cmdPool, static_cast<uint32_t>(drawCmdBuffers.size()), drawCmdBuffers.data());
         drawCmdBuffers.clear();
+
+        destroySecondaryCommandPools();
+
+        gpuProfiler.destroy();
+    }
+
+    void VulgineImpl::createSecondaryCommandPools() {
+        VkCommandPoolCreateInfo cmdPoolInfo = {};
+        cmdPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        cmdPoolInfo.queueFamilyIndex = swapChain.queueNodeIndex;
+
+        secondaryPools.resize(swapChain.imageCount);
+
+        for(auto& imagePools: secondaryPools){
+            imagePools.resize(settings.recordingThreads + 1);
+            for(auto& slotPool: imagePools)
+                VK_CHECK_RESULT(vkCreateCommandPool(device->logicalDevice, &cmdPoolInfo, nullptr, &slotPool.pool));
+        }
+    }
+
+    void VulgineImpl::destroySecondaryCommandPools() {
+        // destroying the pool frees all buffers allocated from it
+
+        for(auto& imagePools: secondaryPools)
+            for(auto& slotPool: imagePools)
+                vkDestroyCommandPool(device->logicalDevice, slotPool.pool, nullptr);
+
+        secondaryPools.clear();
+    }
+
+    void VulgineImpl::resetSecondaryCommandPools(int imageIndex) {
+        for(auto& slotPool: secondaryPools.at(imageIndex)){
+            if(slotPool.used == 0)
+                continue;
+            VK_CHECK_RESULT(vkResetCommandPool(device->logicalDevice, slotPool.pool, 0));
+            slotPool.used = 0;
+        }
+    }
+
+    VkCommandBuffer VulgineImpl::beginSecondaryCommandBuffer(int imageIndex, uint32_t slot, RenderPassImpl* pass, uint32_t subpass) {
+        auto& slotPool = secondaryPools.at(imageIndex).at(slot);
+
+        if(slotPool.used == slotPool.buffers.size()){
+            VkCommandBuffer newBuffer;
+            VkCommandBufferAllocateInfo cmdBufAllocateInfo =
+                    initializers::commandBufferAllocateInfo(slotPool.pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, 1);
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, &newBuffer));
+            slotPool.buffers.push_back(newBuffer);
+        }
+
+        VkCommandBuffer buffer = slotPool.buffers.at(slotPool.used++);
+
+        VkCommandBufferInheritanceInfo inheritanceInfo = initializers::commandBufferInheritanceInfo();
+        inheritanceInfo.renderPass = pass->renderPass;
+        inheritanceInfo.subpass = subpass;
+        inheritanceInfo.framebuffer = pass->frameBuffer.framebuffers.at(imageIndex);
+
+        VkCommandBufferBeginInfo cmdBufInfo = initializers::commandBufferBeginInfo();
+        cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        if(!settings.reuseCommandBuffers)
+            cmdBufInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+
+        VK_CHECK_RESULT(vkBeginCommandBuffer(buffer, &cmdBufInfo))
+
+        return buffer;
     }
 
 
@@ -193,13 +328,18 @@ namespace Vulgine{
         return err_message;
     }
 
+#ifndef VULGINE_NO_WINDOW
     void error_callback(int code, const char* description){
         errs("GLFW error: " + std::string(description) + "(Error code: " + std::to_string(code) + ")");
     }
+#endif
 
-    bool VulgineImpl::initialize() {
+    bool VulgineImpl::initWindow() {
 
-        initFields();
+#ifdef VULGINE_NO_WINDOW
+        errs("Vulgine is built without window support (VULGINE_WINDOW=OFF), only headless mode is available");
+        return false;
+#else
 
         // initializing GLFW
 
@@ -222,6 +362,21 @@ namespace Vulgine{
 
         logger("GLFW: created window");
 
+        return true;
+#endif
+    }
+
+    bool VulgineImpl::initialize() {
+
+        initFields();
+
+        CPUProfiler::setThreadName("Main thread");
+
+        if(headless)
+            logger("Running in headless mode: window and swap chain are not created");
+        else if(!initWindow())
+            return false;
+
 
         createVkInstance();
 
@@ -245,6 +400,9 @@ namespace Vulgine{
         allocatorInfo.device = device->logicalDevice;
         allocatorInfo.instance = instance;
 
+        if(memoryBudgetSupported)
+            allocatorInfo.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
+
         VK_CHECK_RESULT(vmaCreateAllocator(&allocatorInfo, &allocator))
 
         logger("Vulkan Device Created");
@@ -257,14 +415,32 @@ namespace Vulgine{
 
         logger("Swap chain created");
 
+        uploader.create(device->logicalDevice, device->queueFamilyIndices.transfer, device->queueFamilyIndices.graphics, settings.stagingRingSize);
+
+        vertexPool.create(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, settings.geometryBlockSize);
+        indexPool.create(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, settings.geometryBlockSize / 4);
+
+        uniformRing.create(swapChain.imageCount, settings.uniformRingSize, device->properties.limits.minUniformBufferOffsetAlignment);
+        dirtyUniformBuffers.resize(swapChain.imageCount);
+
         createCommandBuffers();
 
         logger("Command buffers allocated");
 
+        // with single recording thread everything is recorded inline by main thread
+
+        if(settings.recordingThreads > 1)
+            recordingThreads.start(settings.recordingThreads, "Recording worker");
+
+        logger("Recording threads started: " + std::to_string(recordingThreads.size()));
+
         createPipelineCache();
 
         logger("Created pipeline cache");
 
+        if(pipelineMap.async)
+            pipelineMap.compiler.start(std::max(1u, std::thread::hardware_concurrency() / 2), "Pipeline compiler");
+
         loadShaders();
 
         logger("default shader pack loaded");
@@ -301,6 +477,7 @@ namespace Vulgine{
     {
         // Create one command buffer for each swap chain image and reuse for rendering
         drawCmdBuffers.resize(swapChain.imageCount);
+        cmdBuffersState.assign(swapChain.imageCount, CommandBufferState{});
 
         VkCommandBufferAllocateInfo cmdBufAllocateInfo =
                 initializers::commandBufferAllocateInfo(
@@ -309,6 +486,12 @@ namespace Vulgine{
                         static_cast<uint32_t>(drawCmdBuffers.size()));
 
         VK_CHECK_RESULT(vkAllocateCommandBuffers(device->logicalDevice, &cmdBufAllocateInfo, drawCmdBuffers.data()));
+
+        createSecondaryCommandPools();
+
+        // timestamp queries are written by command buffers, so each of them needs its own pool
+
+        gpuProfiler.create(device->physicalDevice, device->logicalDevice, device->queueFamilyIndices.graphics, swapChain.imageCount);
     }
 
     void VulgineImpl::createVkInstance() {
@@ -369,19 +552,33 @@ namespace Vulgine{
         window.title = initializeInfo.windowName;
 
         settings.vsync = initializeInfo.vsync;
+        settings.reuseCommandBuffers = initializeInfo.reuseCommandBuffers;
+        settings.autoInstancing = initializeInfo.autoInstancing;
+        settings.indirectDraws = initializeInfo.indirectDraws;
+        pipelineMap.async = initializeInfo.asyncPipelineCompilation;
+        settings.recordingThreads = initializeInfo.recordingThreads ? initializeInfo.recordingThreads : std::max(1u, std::thread::hardware_concurrency());
         window.fullscreen = initializeInfo.fullscreen;
+        headless = initializeInfo.headless;
 
 
     }
 
     std::vector<const char*> VulgineImpl::getRequiredExtensionsList() {
 
-        uint32_t glfwExtensionCount = 0;
-        const char** glfwExtensions;
+        std::vector<const char*> extensions;
 
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        // surface extensions are needed only to present to window
 
-        std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+#ifndef VULGINE_NO_WINDOW
+        if(!initializeInfo.headless) {
+            uint32_t glfwExtensionCount = 0;
+            const char **glfwExtensions;
+
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+#endif
 
 
         if(initializeInfo.enableVulkanValidationLayers)
@@ -402,14 +599,57 @@ namespace Vulgine{
 
         //TODO: make it available to choose the device
 
+        // timeline semaphore tracks GPU progress of the whole engine, it's core in Vulkan 1.2 but still optional
+
+        VkPhysicalDeviceTimelineSemaphoreFeatures supportedTimelineFeatures{};
+        supportedTimelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+
+        VkPhysicalDeviceFeatures2 supportedFeatures{};
+        supportedFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures.pNext = &supportedTimelineFeatures;
 
+        vkGetPhysicalDeviceFeatures2(availableDevices[0], &supportedFeatures);
+
+        if(!supportedTimelineFeatures.timelineSemaphore){
+            Utilities::ExitFatal(-1, "Selected GPU doesn't support timeline semaphores");
+        }
+
+        timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+        timelineSemaphoreFeatures.pNext = deviceCreatepNextChain;
+        deviceCreatepNextChain = &timelineSemaphoreFeatures;
+
+        // Draws sharing state are issued by one indirect call, if device takes more than one draw per call.
+        // Static instances are addressed by first instance, which indirect commands may set only with its feature
+
+        enabledFeatures.multiDrawIndirect = supportedFeatures.features.multiDrawIndirect;
+        enabledFeatures.drawIndirectFirstInstance = supportedFeatures.features.drawIndirectFirstInstance;
 
         device = new VulkanDevice(availableDevices[0]);
-        VkResult res = device->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain);
+
+        // budget isn't required, VMA estimates it from heap sizes without the extension
+
+        memoryBudgetSupported = device->extensionSupported(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+        if(memoryBudgetSupported)
+            enabledDeviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+        bool drawIndirectCountSupported = device->extensionSupported(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+        if(drawIndirectCountSupported)
+            enabledDeviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+
+        VkResult res = device->createLogicalDevice(enabledFeatures, enabledDeviceExtensions, deviceCreatepNextChain, !headless);
         if (res != VK_SUCCESS) {
             Utilities::ExitFatal(res, "Could not create Vulkan device: \n" + Utilities::errorString(res));
         }
 
+        // draw count in buffer lets draws be generated on GPU later without recording commands again
+
+        if(drawIndirectCountSupported)
+            fpCmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+                    vkGetDeviceProcAddr(device->logicalDevice, "vkCmdDrawIndexedIndirectCountKHR"));
+
         if(!getSupportedDepthFormat()){
             Utilities::ExitFatal(-1, "Selected GPU doesn't support any depth format");
         }
@@ -421,6 +661,13 @@ namespace Vulgine{
 
         vkGetDeviceQueue(device->logicalDevice, device->queueFamilyIndices.transfer, 0, &transferQueue);
 
+        // without surface there is no need to look for present-capable queue, graphics one does everything
+
+        if(headless){
+            swapChain.queueNodeIndex = device->queueFamilyIndices.graphics;
+            return;
+        }
+
         swapChain.connect(instance, device->physicalDevice, device->logicalDevice);
 
         swapChain.initSurface(window.instance());
@@ -428,68 +675,149 @@ namespace Vulgine{
     }
 
     void VulgineImpl::renderFrame() {
-        static uint32_t frame_number = 0;
 
+        VULGINE_PROFILE_ZONE("renderFrame");
 
         if(window.resized)
             windowResize();
 
+        {
+            VULGINE_PROFILE_ZONE("wait frame in flight");
+            timeline.wait(framesSync[currentFrame].submitted);
+        }
 
-        vkWaitForFences(device->logicalDevice, 1, &framesSync[currentFrame].inFlightSync, VK_TRUE, UINT64_MAX);
+        // GPU may be even further than this slot's last frame, so everything it is done with goes away
 
+        uint64_t completed = timeline.completed();
 
-        // Acquire the next image from the swap chain
-        VkResult result = swapChain.acquireNextImage(&currentBuffer, framesSync[currentFrame].presentComplete);
-        // Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
-        if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
-            windowResize();
+        destroyRetired(completed);
+        uploader.collect(completed);
+
+        VkResult result;
+
+        if(headless){
+            // readback of the frame this slot rendered last time has finished as well
+
+            deliverHeadlessFrame(currentFrame);
+
+            // targets are used in round-robin order
+
+            currentBuffer = submittedFrames % swapChain.imageCount;
+        } else {
+            VULGINE_PROFILE_ZONE("acquire image");
+            // Acquire the next image from the swap chain
+            result = swapChain.acquireNextImage(&currentBuffer, framesSync[currentFrame].presentComplete);
+            // Recreate the swapchain if it's no longer compatible with the surface (OUT_OF_DATE) or no longer optimal for presentation (SUBOPTIMAL)
+            if ((result == VK_ERROR_OUT_OF_DATE_KHR) || (result == VK_SUBOPTIMAL_KHR)) {
+                windowResize();
+            } else {
+                VK_CHECK_RESULT(result);
+            }
         }
-        else {
-            VK_CHECK_RESULT(result);
+
+        // Command buffer and per-image resources of acquired image may still be in use by previous frame
+
+        {
+            VULGINE_PROFILE_ZONE("wait image");
+            timeline.wait(imageTimelineValues.at(currentBuffer));
         }
 
-        onCycle();
+        // GPU is done with this image's command buffer, so its timestamps are ready
 
+        gpuProfiler.collect(currentBuffer);
+
+        {
+            VULGINE_PROFILE_ZONE("onCycle");
+            onCycle();
+        }
+
+        // gui draw commands are tracked per image, so only this image's command buffer is affected
 
         if(gui.update(currentBuffer))
-            cmdBuffersOutdated = true;
+            cmdBuffersState.at(currentBuffer).outdated = true;
 
         // synchronize dynamic buffers data
 
-        uniformBuffers.iterate([](UniformBufferImpl& buffer){ buffer.sync();});
-        scenes.iterate([](SceneImpl& scene){ scene.update(); scene.lightUBO->sync();});
+        {
+            VULGINE_PROFILE_ZONE("sync dynamic data");
+            scenes.iterate([](SceneImpl &scene) { scene.update(); });
+            syncUniformBuffers(currentBuffer);
+        }
 
-        if(frame_number % 60 == 1){
-            vkDeviceWaitIdle(device->logicalDevice);
-            materials.removeUnused();
-            samplers.removeUnused();
-            uniformBuffers.removeUnused();
-            images.removeUnused();
-            meshes.removeUnused();
+        scenes.iterate([this](SceneImpl& scene){
+            if(scene.drawListChanged())
+                cmdBuffersOutdated = true;
+        });
+
+        if(MeshImpl::highlightedMesh() != recordedHighlight){
+            recordedHighlight = MeshImpl::highlightedMesh();
+            cmdBuffersOutdated = true;
         }
 
-        buildCommandBuffers(currentBuffer);
+        // skipped draws of compiling pipelines must be recorded now
+
+        if(pipelineMap.pollReady())
+            cmdBuffersOutdated = true;
+
+        // static data replaced by finished uploads is drawn from now on
+
+        if(applySwaps())
+            cmdBuffersOutdated = true;
+
+        // moved resources are referred by new handles from now on
+
+        if(defragmenter.step(settings.defragmentationBytesPerFrame))
+            cmdBuffersOutdated = true;
 
-        if (swapChainFences[currentBuffer] != VK_NULL_HANDLE) {
-            vkWaitForFences(device->logicalDevice, 1, &swapChainFences[currentBuffer], VK_TRUE, UINT64_MAX);
+        if(cmdBuffersOutdated){
+            for(auto& state: cmdBuffersState)
+                state.outdated = true;
+            cmdBuffersOutdated = false;
+            drawRevision++;
         }
-        // Mark the image as now being in use by this frame
-        swapChainFences[currentBuffer] = framesSync[currentFrame].inFlightSync;
+
+        auto const& cmdBufferState = cmdBuffersState.at(currentBuffer);
+
+        if(!settings.reuseCommandBuffers || cmdBufferState.outdated || cmdBufferState.frameDependent)
+            buildCommandBuffers(currentBuffer);
 
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &drawCmdBuffers[currentBuffer];
 
-        submitInfo.waitSemaphoreCount = 1;
+        // nothing is acquired or presented in headless mode, so frame is ordered by timeline only
+
+        submitInfo.waitSemaphoreCount = headless ? 0 : 1;
         submitInfo.pWaitSemaphores = &framesSync[currentFrame].presentComplete;
+        submitInfo.signalSemaphoreCount = headless ? 0 : 1;
         submitInfo.pSignalSemaphores = &framesSync[currentFrame].renderComplete;
 
-        vkResetFences(device->logicalDevice, 1, &framesSync[currentFrame].inFlightSync);
+        // uploads requested so far are submitted first, so the frame sees their results
 
+        uploader.flush();
 
-        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, framesSync[currentFrame].inFlightSync));
+        {
+            VULGINE_PROFILE_ZONE("queue submit");
+            uint64_t value = timeline.submit(queue, submitInfo);
+            framesSync[currentFrame].submitted = value;
+            imageTimelineValues.at(currentBuffer) = value;
+        }
+
+        stampRetired(framesSync[currentFrame].submitted);
+
+        gpuProfiler.submitted(currentBuffer, submittedFrames);
+
+        if(headless){
+            headlessTargets.at(currentBuffer).frame = submittedFrames++;
+            headlessPendingTargets.at(currentFrame) = static_cast<int>(currentBuffer);
+            currentFrame = (currentFrame + 1) % settings.framesInFlight;
+            return;
+        }
+
+        submittedFrames++;
 
 
         //if(lastBuffer != -1) {
+            VULGINE_PROFILE_ZONE("present");
             result = swapChain.queuePresent(queue, currentBuffer, framesSync[currentFrame].renderComplete);
             if (!((result == VK_SUCCESS) || (result == VK_SUBOPTIMAL_KHR))) {
                 if (result == VK_ERROR_OUT_OF_DATE_KHR) {
@@ -505,8 +833,6 @@ namespace Vulgine{
 
         currentFrame = (currentFrame + 1) % settings.framesInFlight;
 
-
-        frame_number++;
     }
 
 
@@ -553,29 +879,12 @@ namespace Vulgine{
 
 
 
-    void VulgineImpl::buildRenderPass(RenderPassImplRef const& renderPass){
-
-        renderPass->buildPass();
-
-        renderPassLine.push_front(renderPass);
-
-        renderPass->create();
-
-        for(auto& pass: renderPass->dependencies) {
-            auto passRef = renderPasses.getImpl(pass.lock()->id());
-
-            buildRenderPass(passRef);
-        }
-
-    }
-
     void VulgineImpl::buildRenderPasses() {
 
         // Step 1: find onscreen render pass
 
         int onscreenRenderPassCount = 0;
         uint32_t found = UINT32_MAX;
-        renderPassLine.clear();
 
         renderPasses.iterate([&onscreenRenderPassCount, &found](RenderPassImpl& renderPass)
         {
@@ -591,14 +900,23 @@ namespace Vulgine{
 
         onscreenRenderPass = renderPasses.getImpl(found);
 
+        // Step 2: order passes by dependencies and build them
+
+        RenderGraph::compile(onscreenRenderPass, renderPassLine);
+
+        std::vector<RenderPassImpl*> passes;
+        for(auto const& pass: renderPassLine)
+            passes.push_back(pass.get());
 
-        buildRenderPass(onscreenRenderPass); // TODO: parse dependency graph to detect loops
+        renderGraph.build(renderPassLine, passes);
 
 
         // every pipeline should be recreated here because it's state depends on render pass state
 
         pipelineMap.clear();
 
+        drawRevision++;
+
         gui.subpass = onscreenRenderPass->deferredEnabled ? 2 : 0;
 
         gui.preparePipeline(onscreenRenderPass->renderPass);
@@ -610,11 +928,143 @@ namespace Vulgine{
 
     }
 
+    namespace {
+
+        // Prepended to pipeline cache data stored on disk. Vulkan's own cache header lacks driver version,
+        // and some drivers are known to accept caches produced by a different driver build.
+
+        struct PipelineCacheFileHeader{
+            uint32_t magic;
+            uint32_t vendorID;
+            uint32_t deviceID;
+            uint32_t driverVersion;
+            uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+            uint64_t dataSize;
+        };
+
+        constexpr const uint32_t pipelineCacheMagic = 0x434c5056; // "VPLC"
+
+        PipelineCacheFileHeader makePipelineCacheHeader(VkPhysicalDeviceProperties const& props, uint64_t dataSize){
+            PipelineCacheFileHeader header{};
+            header.magic = pipelineCacheMagic;
+            header.vendorID = props.vendorID;
+            header.deviceID = props.deviceID;
+            header.driverVersion = props.driverVersion;
+            memcpy(header.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+            header.dataSize = dataSize;
+            return header;
+        }
+
+        std::vector<char> loadPipelineCacheData(std::string const& path, VkPhysicalDeviceProperties const& props){
+            std::vector<char> data;
+            std::ifstream is(path, std::ios::binary | std::ios::in | std::ios::ate);
+
+            if(!is.is_open())
+                return data;
+
+            auto fileSize = static_cast<uint64_t>(is.tellg());
+            is.seekg(0);
+
+            PipelineCacheFileHeader header{};
+            is.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+            auto expected = makePipelineCacheHeader(props, header.dataSize);
+
+            if(!is || memcmp(&header, &expected, sizeof(header)) != 0){
+                logger("Pipeline cache \"" + path + "\" was created by different device or driver. Ignoring it");
+                return data;
+            }
+
+            // size in header isn't trusted before it's checked against the file
+
+            if(header.dataSize != fileSize - sizeof(header)){
+                logger("Pipeline cache \"" + path + "\" is truncated or corrupted. Ignoring it");
+                return data;
+            }
+
+            data.resize(header.dataSize);
+            is.read(data.data(), static_cast<std::streamsize>(data.size()));
+
+            if(!is){
+                logger("Pipeline cache \"" + path + "\" is truncated. Ignoring it");
+                data.clear();
+            }
+
+            return data;
+        }
+    }
+
     void VulgineImpl::createPipelineCache()
     {
+        std::vector<char> initialData;
+
+        if(!initializeInfo.pipelineCachePath.empty())
+            initialData = loadPipelineCacheData(initializeInfo.pipelineCachePath, device->properties);
+
         VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
         pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-        VK_CHECK_RESULT(vkCreatePipelineCache(device->logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache));
+        pipelineCacheCreateInfo.initialDataSize = initialData.size();
+        pipelineCacheCreateInfo.pInitialData = initialData.empty() ? nullptr : initialData.data();
+
+        VkResult result = vkCreatePipelineCache(device->logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+
+        // driver is still allowed to reject the data, so try again with empty cache before giving up
+
+        if(result != VK_SUCCESS && !initialData.empty()){
+            errs("Failed to create pipeline cache from \"" + initializeInfo.pipelineCachePath + "\": " + Utilities::errorString(result));
+            pipelineCacheCreateInfo.initialDataSize = 0;
+            pipelineCacheCreateInfo.pInitialData = nullptr;
+            result = vkCreatePipelineCache(device->logicalDevice, &pipelineCacheCreateInfo, nullptr, &pipelineCache);
+        }
+
+        VK_CHECK_RESULT(result)
+
+        if(!initialData.empty())
+            logger("Pipeline cache loaded from \"" + initializeInfo.pipelineCachePath + "\" (" + std::to_string(initialData.size()) + " bytes)");
+    }
+
+    void VulgineImpl::savePipelineCache() {
+        if(initializeInfo.pipelineCachePath.empty())
+            return;
+
+        size_t dataSize = 0;
+        VK_CHECK_RESULT(vkGetPipelineCacheData(device->logicalDevice, pipelineCache, &dataSize, nullptr))
+
+        std::vector<char> data(dataSize);
+        VK_CHECK_RESULT(vkGetPipelineCacheData(device->logicalDevice, pipelineCache, &dataSize, data.data()))
+
+        // write to temporary file first, so crash in the middle doesn't leave corrupted cache
+
+        std::string tmpPath = initializeInfo.pipelineCachePath + ".tmp";
+        {
+            std::ofstream os(tmpPath, std::ios::binary | std::ios::out | std::ios::trunc);
+            if(!os.is_open()){
+                errs("Cannot open \"" + tmpPath + "\" to save pipeline cache");
+                return;
+            }
+
+            auto header = makePipelineCacheHeader(device->properties, dataSize);
+            os.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            os.write(data.data(), static_cast<std::streamsize>(dataSize));
+
+            if(!os){
+                errs("Failed to write pipeline cache to \"" + tmpPath + "\"");
+                return;
+            }
+        }
+
+        // Old cache is replaced by rename, so it stays intact until the new one takes its place.
+        // Filesystem rename replaces existing file on Windows as well
+
+        std::error_code error;
+        std::filesystem::rename(tmpPath, initializeInfo.pipelineCachePath, error);
+
+        if(error){
+            errs("Failed to save pipeline cache to \"" + initializeInfo.pipelineCachePath + "\": " + error.message());
+            return;
+        }
+
+        logger("Pipeline cache saved to \"" + initializeInfo.pipelineCachePath + "\" (" + std::to_string(dataSize) + " bytes)");
     }
 
     VkShaderModule loadShader(const char *fileName, VkDevice device)
@@ -692,37 +1142,179 @@ namespace Vulgine{
 
     void VulgineImpl::buildCommandBuffers(int imageIndex) {
 
+        VULGINE_PROFILE_ZONE("buildCommandBuffers");
 
         VkCommandBufferBeginInfo cmdBufInfo = initializers::commandBufferBeginInfo();
 
-        cmdBufInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        // recorded buffers are submitted many times unless reuse is disabled
+
+        if(!settings.reuseCommandBuffers)
+            cmdBufInfo.flags |= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
         VK_CHECK_RESULT(vkBeginCommandBuffer(drawCmdBuffers[imageIndex], &cmdBufInfo))
 
+        frameDependentCommands = false;
+        recordedBinds = 0;
+        elidedBinds = 0;
+
+        // image's previous submission is finished, so its descriptor sets may be rewritten before they are bound again
+
+        refreshDescriptors(imageIndex);
+
+        // secondary buffers of this image are referenced only by its primary buffer, which is not in use now
+
+        resetSecondaryCommandPools(imageIndex);
+
+        gpuProfiler.beginFrame(drawCmdBuffers[imageIndex], imageIndex);
+
         for(auto const& renderPass: renderPassLine) {
             assert(renderPass->camera && "RenderPass must have bounded camera");
             assert(renderPass->scene && "RenderPass must have bounded scene");
 
-            renderPass->begin(drawCmdBuffers[imageIndex], imageIndex);
+            renderPass->compileDrawPackets();
+
+            // mesh may be drawn by packets recorded by different threads, so its data is pushed once here
 
-            renderPass->buildCmdBuffers(drawCmdBuffers[imageIndex], imageIndex);
+            renderPass->pushDynamicData();
 
-            if(renderPass->onscreen)
-                gui.draw(drawCmdBuffers[imageIndex], imageIndex);
+            bool parallel = renderPass->recordsInParallel();
+
+            renderPass->begin(drawCmdBuffers[imageIndex], imageIndex, parallel ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+
+            renderPass->buildCmdBuffers(drawCmdBuffers[imageIndex], imageIndex, parallel);
 
             renderPass->end(drawCmdBuffers[imageIndex]);
 
 
         }
 
+        if(headless) {
+            gpuProfiler.beginZone(drawCmdBuffers[imageIndex], "Readback");
+            recordHeadlessReadback(drawCmdBuffers[imageIndex], imageIndex);
+            gpuProfiler.endZone(drawCmdBuffers[imageIndex]);
+        }
+
+        gpuProfiler.endFrame();
+
         VK_CHECK_RESULT(vkEndCommandBuffer(drawCmdBuffers[imageIndex]));
 
-        cmdBuffersOutdated = false;
+        auto& state = cmdBuffersState.at(imageIndex);
+        state.outdated = false;
+        state.frameDependent = frameDependentCommands;
 
         prepared = true;
     }
 
     void VulgineImpl::setupSwapChain(){
-        swapChain.create(&vieportInfo.width, &vieportInfo.height, settings.vsync);
+        if(headless)
+            createHeadlessTargets();
+        else
+            swapChain.create(&vieportInfo.width, &vieportInfo.height, settings.vsync);
+    }
+
+    void VulgineImpl::createHeadlessTargets() {
+
+        // same amount of targets as typical swap chain would have, so per-image resources behave the same way
+
+        constexpr const uint32_t targetCount = 3;
+
+        vieportInfo.width = window.width;
+        vieportInfo.height = window.height;
+
+        swapChain.colorFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        swapChain.imageCount = targetCount;
+        swapChain.images.resize(targetCount);
+        swapChain.buffers.resize(targetCount);
+
+        headlessTargets.resize(targetCount);
+        headlessPendingTargets.assign(settings.framesInFlight, -1);
+
+        VkImageCreateInfo imageCI = initializers::imageCreateInfo();
+        imageCI.imageType = VK_IMAGE_TYPE_2D;
+        imageCI.format = swapChain.colorFormat;
+        imageCI.extent = {vieportInfo.width, vieportInfo.height, 1};
+        imageCI.mipLevels = 1;
+        imageCI.arrayLayers = 1;
+        imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                                                     vieportInfo.width * vieportInfo.height * 4);
+        bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        for(int i = 0; i < targetCount; ++i){
+            auto& target = headlessTargets.at(i);
+
+            target.image.allocate(imageCI, VMA_MEMORY_USAGE_GPU_ONLY);
+            target.readback.allocate(bufferCI, VMA_MEMORY_USAGE_GPU_TO_CPU);
+            VK_CHECK_RESULT(vmaMapMemory(allocator, target.readback.allocation, &target.mapped))
+
+            swapChain.images.at(i) = target.image.image;
+            swapChain.buffers.at(i).image = target.image.image;
+            swapChain.buffers.at(i).view = target.image.createImageView();
+        }
+    }
+
+    void VulgineImpl::destroyHeadlessTargets() {
+        for(int i = 0; i < headlessTargets.size(); ++i){
+            auto& target = headlessTargets.at(i);
+
+            vkDestroyImageView(device->logicalDevice, swapChain.buffers.at(i).view, nullptr);
+            vmaUnmapMemory(allocator, target.readback.allocation);
+            target.readback.free();
+            target.image.free();
+        }
+
+        headlessTargets.clear();
+        swapChain.buffers.clear();
+        swapChain.images.clear();
+        swapChain.imageCount = 0;
+    }
+
+    void VulgineImpl::recordHeadlessReadback(VkCommandBuffer buffer, int imageIndex) {
+        auto& target = headlessTargets.at(imageIndex);
+
+        // onscreen pass leaves target in transfer source layout, its exit dependency already waits for color writes
+
+        VkBufferImageCopy region{};
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent = {vieportInfo.width, vieportInfo.height, 1};
+
+        vkCmdCopyImageToBuffer(buffer, target.image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.readback.buffer, 1, &region);
+
+        VkBufferMemoryBarrier bufferBarrier = initializers::bufferMemoryBarrier();
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferBarrier.buffer = target.readback.buffer;
+        bufferBarrier.offset = 0;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT,
+                             0, 0, nullptr, 1, &bufferBarrier, 0, nullptr);
+    }
+
+    void VulgineImpl::deliverHeadlessFrame(int frameSlot) {
+        int targetIndex = headlessPendingTargets.at(frameSlot);
+        if(targetIndex < 0)
+            return;
+
+        headlessPendingTargets.at(frameSlot) = -1;
+
+        auto& target = headlessTargets.at(targetIndex);
+
+        // readback memory is not necessarily host-coherent
+
+        vmaInvalidateAllocation(allocator, target.readback.allocation, 0, VK_WHOLE_SIZE);
+
+        HeadlessFrame frame{};
+        frame.pixels = target.mapped;
+        frame.width = vieportInfo.width;
+        frame.height = vieportInfo.height;
+        frame.index = target.frame;
+
+        onFrame(frame);
     }
 
     void VulgineImpl::windowResize() {
@@ -786,6 +1378,111 @@ namespace Vulgine{
         return fpsCounter.lastFrameTime;
     }
 
+    bool VulgineImpl::exportCPUTrace(const char *filename) {
+#ifdef VULGINE_CPU_PROFILER
+        return CPUProfiler::exportTrace(filename);
+#else
+        errs("CPU profiler zones are compiled out, rebuild with VULGINE_CPU_PROFILER option to use it");
+        return false;
+#endif
+    }
+
+    bool VulgineImpl::exportGPUTrace(const char *filename) {
+        if(!gpuProfiler.active()){
+            errs("GPU profiler is disabled or unsupported, there is nothing to export");
+            return false;
+        }
+
+        return gpuProfiler.exportTrace(filename);
+    }
+
+    Vulgine::MemoryStatistics VulgineImpl::memoryStatistics() {
+        MemoryStatistics ret{};
+
+        const VkPhysicalDeviceMemoryProperties* memoryProperties;
+        vmaGetMemoryProperties(allocator, &memoryProperties);
+
+        std::vector<VmaBudget> budgets(memoryProperties->memoryHeapCount);
+        vmaGetBudget(allocator, budgets.data());
+
+        for(uint32_t i = 0; i < memoryProperties->memoryHeapCount; ++i){
+            auto& heap = ret.heaps.emplace_back();
+            heap.size = memoryProperties->memoryHeaps[i].size;
+            heap.budget = budgets.at(i).budget;
+            heap.usage = budgets.at(i).usage;
+            heap.blockBytes = budgets.at(i).blockBytes;
+            heap.allocationBytes = budgets.at(i).allocationBytes;
+            heap.deviceLocal = memoryProperties->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT;
+        }
+
+        ret.driverBudget = memoryBudgetSupported;
+
+        meshes.iterate([&ret](MeshImpl& mesh){
+            ret.meshBytes += mesh.staticVertices.size + mesh.pendingVertices.size;
+            ret.meshBytes += mesh.staticInstances.size + mesh.pendingInstances.size;
+            ret.meshBytes += mesh.staticIndices.size;
+
+            for(auto const& dynamicData: mesh.perVertex)
+                ret.meshBytes += dynamicData.buffer->allocationSize();
+            for(auto const& dynamicData: mesh.perInstance)
+                ret.meshBytes += dynamicData.buffer->allocationSize();
+        });
+
+        ret.geometryPoolBytes = vertexPool.capacity() + indexPool.capacity();
+
+        images.iterate([&ret](StaticImageImpl& image){
+            ret.imageBytes += image.image.allocationSize();
+        });
+
+        uniformBuffers.iterate([&ret](UniformBufferImpl& buffer){
+            for(auto const* buf: buffer.buffers)
+                ret.uniformBufferBytes += buf->allocationSize();
+        });
+
+        ret.uniformBufferBytes += uniformRing.allocationSize();
+
+        // transient attachments have no memory of their own, it's counted by heaps
+
+        renderPasses.iterate([&ret](RenderPassImpl& renderPass){
+            for(auto const& attachment: renderPass.frameBuffer.attachmentsImages)
+                for(auto const& image: attachment.second->images)
+                    ret.attachmentBytes += image.allocationSize();
+        });
+
+        ret.attachmentBytes += renderGraph.transientBytes();
+
+        for(auto const& target: headlessTargets)
+            ret.attachmentBytes += target.image.allocationSize() + target.readback.allocationSize();
+
+        ret.stagingBytes = uploader.stagingSize();
+
+        return ret;
+    }
+
+    bool VulgineImpl::exportMemoryStatistics(const char *filename) {
+        std::ofstream os(filename, std::ios::out | std::ios::trunc);
+
+        if(!os.is_open()){
+            errs("Memory statistics: could not open file " + std::string(filename));
+            return false;
+        }
+
+        // detailed map lists every block and allocation
+
+        char* stats;
+        vmaBuildStatsString(allocator, &stats, VK_TRUE);
+
+        os << stats;
+
+        vmaFreeStatsString(allocator, stats);
+
+        return os.good();
+    }
+
+    void VulgineImpl::defragmentMemory() {
+        defragmenter.start();
+    }
+
     void VulgineImpl::createSyncPrimitives() {
 
         assert(settings.framesInFlight <= swapChain.imageCount && "FIF count must be less or equal to number of swap chain image buffers");
@@ -794,9 +1491,6 @@ namespace Vulgine{
 
         VkSemaphoreCreateInfo semaphoreCreateInfo = initializers::semaphoreCreateInfo();
 
-        VkFenceCreateInfo fenceCreateInfo = initializers::fenceCreateInfo();
-        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
         for(auto& frameSync: framesSync) {
             // Create a semaphore used to synchronize image presentation
             // Ensures that the image is displayed before we start submitting new commands to the queue
@@ -806,11 +1500,10 @@ namespace Vulgine{
             // Ensures that the image is not presented until all commands have been submitted and executed
             VK_CHECK_RESULT(vkCreateSemaphore(device->logicalDevice, &semaphoreCreateInfo, nullptr,
                                               &frameSync.renderComplete));
-
-            VK_CHECK_RESULT(vkCreateFence(device->logicalDevice, &fenceCreateInfo, nullptr,
-                                              &frameSync.inFlightSync));
         }
 
+        timeline.create(device->logicalDevice);
+
         currentFrame = 0;
 
         // Set up submit info structure
@@ -823,7 +1516,7 @@ namespace Vulgine{
         submitInfo.signalSemaphoreCount = 1;
         submitInfo.pSignalSemaphores = &framesSync[currentFrame].renderComplete;
 
-        swapChainFences.resize(swapChain.imageCount, VK_NULL_HANDLE);
+        imageTimelineValues.resize(swapChain.imageCount, 0);
 
     }
 
@@ -831,10 +1524,11 @@ namespace Vulgine{
         for(auto& frameSync: framesSync) {
             vkDestroySemaphore(device->logicalDevice, frameSync.presentComplete, nullptr);
             vkDestroySemaphore(device->logicalDevice, frameSync.renderComplete, nullptr);
-            vkDestroyFence(device->logicalDevice, frameSync.inFlightSync, nullptr);
         }
 
         framesSync.clear();
+
+        timeline.destroy();
     }
 
     void VulgineImpl::keyPressed(VulgineImpl::Window *window, int key) {
@@ -854,12 +1548,18 @@ namespace Vulgine{
     }
 
     void VulgineImpl::disableCursor() {
-        glfwSetInputMode(window.instance(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#ifndef VULGINE_NO_WINDOW
+        if(!headless)
+            glfwSetInputMode(window.instance(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+#endif
         mouseState.cursor.enabled = false;
     }
 
     void VulgineImpl::enableCursor() {
-        glfwSetInputMode(window.instance(), GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+#ifndef VULGINE_NO_WINDOW
+        if(!headless)
+            glfwSetInputMode(window.instance(), GLFW_CURSOR, GLFW_CURSOR_NORMAL);
+#endif
         mouseState.cursor.enabled = true;
 
     }
@@ -872,7 +1572,7 @@ namespace Vulgine{
 
         std::map<VkDescriptorType, uint32_t> types;
 
-        types[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER] = 1 * 1024;
+        types[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC] = 1 * 1024;
         types[VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER] = 1 * 1024;
 
         perMaterialPool.descriptorsCapacity = std::move(types);
@@ -880,7 +1580,7 @@ namespace Vulgine{
 
         std::map<VkDescriptorType, uint32_t> types1;
 
-        types1[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER] = 1 * 1024;
+        types1[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC] = 1 * 1024;
         types1[VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER] = 1 * 1024;
 
         perMeshPool.returnable = true;
@@ -891,7 +1591,7 @@ namespace Vulgine{
 
         std::map<VkDescriptorType, uint32_t> types2;
 
-        types2[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER] = 1 * 20;
+        types2[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC] = 1 * 20;
         types2[VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT] = 4 * 20;
 
         perRenderPassPool.maxSets = 20;
@@ -914,6 +1614,8 @@ namespace Vulgine{
 
     void VulgineImpl::updateGUI() {
 
+        VULGINE_PROFILE_ZONE("updateGUI");
+
         ImGuiIO& io = ImGui::GetIO();
 
         io.DisplaySize = ImVec2((float)vieportInfo.width, (float)vieportInfo.height);
@@ -1003,7 +1705,9 @@ namespace Vulgine{
             return;
         }
 
-        vkQueueWaitIdle(queue);
+        // onscreen pass is rebuilt in place, so frames referring to it must finish
+
+        timeline.waitIdle();
 
         settings.msaa = newValue;
 
@@ -1014,8 +1718,9 @@ namespace Vulgine{
                 onscreenFb.destroy();
             }
 
-            onscreenRenderPass->buildPass();
-            onscreenRenderPass->create();
+            renderGraph.build(renderPassLine, {onscreenRenderPass.get()});
+
+            cmdBuffersOutdated = true;
         }
 
 
@@ -1065,17 +1770,18 @@ namespace Vulgine{
 
 
     void VulgineImpl::recreateOnscreenFramebuffers() {
-        if(onscreenRenderPass && !glfwGetWindowAttrib(window.instance(), GLFW_ICONIFIED)){
+#ifdef VULGINE_NO_WINDOW
+        if(onscreenRenderPass){
+#else
+        if(onscreenRenderPass && (headless || !glfwGetWindowAttrib(window.instance(), GLFW_ICONIFIED))){
+#endif
             auto& onscreenFb = onscreenRenderPass->frameBuffer;
             if(onscreenFb.isCreated()){
 
-                onscreenRenderPass->destroyFramebuffer();
-
                 onscreenRenderPass->framebufferExtents.width = vieportInfo.width;
                 onscreenRenderPass->framebufferExtents.height = vieportInfo.height;
 
-                onscreenRenderPass->createFramebuffer();
-                onscreenFb.create();
+                renderGraph.rebuildFramebuffers({onscreenRenderPass.get()});
 
                 // Command buffers need to be recreated as they may store
                 // references to the recreated frame buffer
@@ -1125,6 +1831,7 @@ namespace Vulgine{
     }
 
 
+#ifndef VULGINE_NO_WINDOW
     void VulgineImpl::Window::init() {
         // creating window
 
@@ -1286,6 +1993,15 @@ namespace Vulgine{
         auto* wrappedWindow = windowMap.at(window);
         GetImpl().charInput(wrappedWindow, unicode);
     }
+#else
+    // window is never created in builds without window support, engine runs headless only
+
+    void VulgineImpl::Window::init() {}
+    void VulgineImpl::Window::terminate() {}
+    void VulgineImpl::Window::goFullscreen() {}
+    void VulgineImpl::Window::goWindowed() {}
+    void VulgineImpl::Window::setWindowTitle(std::string const& ttl) { title = ttl; }
+#endif
 
     void VulgineImpl::FpsCounter::update(double deltaT) {
 
@@ -1301,29 +2017,209 @@ namespace Vulgine{
         }
     }
 
-    void VulgineImpl::PipelineMap::add(PipelineKey key) {
+    VulgineImpl::PipelineMap::Entry& VulgineImpl::PipelineMap::request(PipelineKey key) {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto it = map.find(key);
+        if(it != map.end())
+            return it->second;
+
+        auto& entry = map.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(key)).first->second;
+
+        if(async){
+            // std::map nodes are stable, so entry stays valid until clear(), which waits for compiler
+
+            compiler.push([this, &entry](){
+                VULGINE_PROFILE_ZONE("compile pipeline");
+                entry.pipeline.create();
+                entry.ready = true;
+                newPipelinesReady = true;
+            });
+        } else {
+            entry.pipeline.create();
+            entry.ready = true;
+        }
+
+        return entry;
+    }
+
+    void VulgineImpl::flushCommandBuffer(VkCommandBuffer commandBuffer) {
+        VK_CHECK_RESULT(vkEndCommandBuffer(commandBuffer))
+
+        // command buffer comes from device pool of graphics family, so it's executed by graphics queue
+
+        VkSubmitInfo submitInfo = initializers::submitInfo();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        timeline.wait(timeline.submit(queue, submitInfo));
+
+        vkFreeCommandBuffers(device->logicalDevice, device->commandPool, 1, &commandBuffer);
+    }
+
+    void VulgineImpl::retire(std::function<void()> destroy) {
+        std::lock_guard<std::mutex> lock{retiredObjectsMutex};
+
+        // frame being recorded now (or the next one) may still use the object. Other submissions (uploads)
+        // may signal timeline before it, so value is set once the frame is submitted
+
+        retiredObjects.push_back({UINT64_MAX, std::move(destroy)});
+    }
+
+    void VulgineImpl::stampRetired(uint64_t frameValue) {
+        std::lock_guard<std::mutex> lock{retiredObjectsMutex};
+
+        for(auto it = retiredObjects.rbegin(); it != retiredObjects.rend() && it->value == UINT64_MAX; ++it)
+            it->value = frameValue;
+    }
+
+    void VulgineImpl::destroyRetired(uint64_t completedValue) {
+        VULGINE_PROFILE_ZONE("destroyRetired");
+
+        for(;;){
+            std::function<void()> destroy;
+            {
+                std::lock_guard<std::mutex> lock{retiredObjectsMutex};
+                if(retiredObjects.empty() || retiredObjects.front().value > completedValue)
+                    return;
+                destroy = std::move(retiredObjects.front().destroy);
+                retiredObjects.pop_front();
+            }
 
-        auto it = map.emplace(std::make_pair(key, key));
+            // destroying an object may release objects it refers to, so lock must not be held here
 
-        if(it.second){
-            it.first->second.create();
+            destroy();
         }
+    }
+
+    void VulgineImpl::swapWhenUploaded(void const* owner, UploadToken token, std::function<void()> swap) {
+        cancelSwap(owner);
+
+        pendingSwaps.push_back({owner, token, std::move(swap)});
+    }
+
+    void VulgineImpl::cancelSwap(void const* owner) {
+        pendingSwaps.erase(std::remove_if(pendingSwaps.begin(), pendingSwaps.end(), [owner](PendingSwap const& pending){
+            return pending.owner == owner;
+        }), pendingSwaps.end());
+    }
+
+    bool VulgineImpl::applySwaps() {
+        if(pendingSwaps.empty())
+            return false;
+
+        // swap may schedule another one, so finished entries are taken out first
+
+        std::vector<PendingSwap> ready;
+
+        auto firstReady = std::stable_partition(pendingSwaps.begin(), pendingSwaps.end(), [this](PendingSwap const& pending){
+            return !uploader.done(pending.token);
+        });
+
+        std::move(firstReady, pendingSwaps.end(), std::back_inserter(ready));
+        pendingSwaps.erase(firstReady, pendingSwaps.end());
+
+        for(auto& pending: ready)
+            pending.swap();
+
+        return !ready.empty();
+    }
+
+    void VulgineImpl::syncUniformBuffers(int imageIndex) {
+        VULGINE_PROFILE_ZONE("sync uniform buffers");
+
+        auto& dirty = dirtyUniformBuffers.at(imageIndex);
+
+        for(auto* buffer: dirty)
+            buffer->sync();
+
+        dirty.clear();
+    }
+
+    void VulgineImpl::refreshDescriptors(int imageIndex) {
+        auto& state = cmdBuffersState.at(imageIndex);
+
+        if(!state.descriptorsOutdated)
+            return;
+
+        for(auto* set: descriptorSets)
+            set->refresh(imageIndex);
 
+        state.descriptorsOutdated = false;
     }
 
-    GeneralPipeline const& VulgineImpl::PipelineMap::bind(PipelineKey key, VkCommandBuffer cmdBuffer) {
-        if(!map.count(key)){
-            add(key);
+    void retireObject(ObjectImpl* object) {
+        auto& vlg = GetImpl();
+
+        // recorded command buffers may refer to the object
+
+        vlg.cmdBuffersOutdated = true;
+
+        vlg.retire([object, &vlg](){
+            vlg.pipelineMap.forget(object);
+            delete object;
+        });
+    }
+
+    void VulgineImpl::PipelineMap::forget(ObjectImpl* object) {
+        // pipeline keys use object addresses, so pipelines must go away before address gets reused
+
+        auto uses = [object](PipelineKey const& key){
+            return static_cast<ObjectImpl*>(key.geometry) == object ||
+                   static_cast<ObjectImpl*>(key.material) == object ||
+                   static_cast<ObjectImpl*>(key.scene) == object ||
+                   static_cast<ObjectImpl*>(key.renderPass) == object;
+        };
+
+        std::unique_lock<std::mutex> lock{mutex};
+
+        // wait for compiler only if it may still work on one of the pipelines
+
+        bool compiling = std::any_of(map.begin(), map.end(), [&uses](auto const& entry){
+            return uses(entry.first) && !entry.second.ready;
+        });
+
+        if(compiling){
+            lock.unlock();
+            compiler.wait();
+            lock.lock();
         }
-        GeneralPipeline& pipeline = map.find(key)->second;
 
-        pipeline.bind(cmdBuffer);
+        for(auto it = map.begin(); it != map.end();){
+            if(uses(it->first))
+                it = map.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void VulgineImpl::PipelineMap::add(PipelineKey key) {
+        request(key);
+    }
+
+    GeneralPipeline const* VulgineImpl::PipelineMap::get(PipelineKey key) {
+        auto& entry = request(key);
+
+        return entry.ready ? &entry.pipeline : nullptr;
+    }
+
+    GeneralPipeline const* VulgineImpl::PipelineMap::bind(PipelineKey key, VkCommandBuffer cmdBuffer) {
+        VULGINE_PROFILE_ZONE("PipelineMap::bind");
+
+        auto* pipeline = get(key);
+
+        if(pipeline)
+            pipeline->bind(cmdBuffer);
 
         return pipeline;
     }
 
     void VulgineImpl::PipelineMap::clear() {
+        compiler.wait();
+
+        std::lock_guard<std::mutex> lock{mutex};
         map.clear();
+        newPipelinesReady = false;
     }
 
     void Vulgine::MouseState::disableCursor() {
@@ -9,12 +9,22 @@
 #include "vulkan/VulkanSwapChain.h"
 #include "vulkan/VulkanAllocatable.h"
 #include "VulgineRenderPass.h"
+#include "VulgineRenderGraph.h"
 #include "VulginePipeline.h"
 #include "vulkan/VulkanDescriptorPool.h"
 #include "VulgineUI.h"
 #include "VulgineImage.h"
+#include "VulgineThreadPool.h"
+#include "VulgineGPUProfiler.h"
+#include "VulgineCPUProfiler.h"
+#include "VulgineTimeline.h"
+#include "VulgineUploader.h"
+#include "VulgineDefragmenter.h"
 #include <vector>
+#include <unordered_set>
 #include <chrono>
+#include <atomic>
+#include <mutex>
 #include <vulkan/VulkanImGui.h>
 
 #define GLFW_INCLUDE_VULKAN
@@ -22,52 +32,134 @@
 
 namespace Vulgine {
 
+    /** hands object which has no more references over to deferred destruction queue */
+    void retireObject(ObjectImpl* object);
+
+    /**
+     * Container doesn't own its objects. Once last reference to an object is dropped,
+     * object is removed from container and retired, so it is destroyed only after GPU
+     * has finished every frame that could use it.
+     *
+     * Objects are kept densely packed, so iteration walks contiguous array. Sparse array indexed
+     * by slot of object id gives position of the object, stale ids are told apart by full id kept along.
+     */
+
     template<typename T, typename TDerived>
     class IdentifiableContainer{
-        std::unordered_map<uint32_t, uint32_t> timeToLive;
-        std::unordered_map<uint32_t, SharedRef<TDerived>> container;
+        struct Entry{
+            uint32_t id;
+            TDerived* object;       // nullptr once released during iteration
+            WeakRef<TDerived> ref;
+        };
+
+        std::vector<Entry> entries;
+        std::vector<uint32_t> positions;
+
+        static constexpr const uint32_t none = UINT32_MAX;
+
+        // ids of objects released while container was iterated
+
+        std::vector<uint32_t> pendingErase;
+        bool iterating = false;
+
+        Entry* find(uint32_t id){
+            auto index = ObjectImpl::slotIndex(id);
+            if(index >= positions.size() || positions[index] == none)
+                return nullptr;
+
+            auto& entry = entries[positions[index]];
+            return entry.id == id ? &entry : nullptr;
+        }
+
+        void erase(uint32_t id){
+            if(!find(id))
+                return;
+
+            auto index = ObjectImpl::slotIndex(id);
+            auto position = positions[index];
+
+            // the last entry takes place of erased one
+
+            if(position != entries.size() - 1){
+                entries[position] = std::move(entries.back());
+                positions[ObjectImpl::slotIndex(entries[position].id)] = position;
+            }
+
+            entries.pop_back();
+            positions[index] = none;
+        }
+
+        void release(TDerived* object){
+            if(iterating){
+                if(auto* entry = find(object->id())) {
+                    entry->object = nullptr;
+                    pendingErase.push_back(object->id());
+                }
+            }
+            else
+                erase(object->id());
+
+            retireObject(object);
+        }
     public:
         SharedRef<T> emplace(){
 
             uint32_t id = ObjectImpl::claimId();
 
-            return SharedRef<T>{((container.emplace(std::piecewise_construct, std::forward_as_tuple(id), std::forward_as_tuple(new TDerived{id})).first)->second)};
+            SharedRef<TDerived> object{new TDerived{id}, [this](TDerived* obj){ release(obj);}};
+
+            auto index = ObjectImpl::slotIndex(id);
+            if(index >= positions.size())
+                positions.resize(index + 1, none);
+
+            positions[index] = entries.size();
+            entries.push_back({id, object.get(), object});
+
+            return object;
         };
-        void removeUnused(){
-            for(auto it = container.begin(), end = container.end(); it != end;){
-                if(it->second.use_count() == 1){
-                    it = container.erase(it);
-                } else
-                    it++;
-            }
-        }
 
         SharedRef<T> get(uint32_t id){
-            auto elem = container.find(id);
-            if(elem == container.end())
-                throw std::out_of_range{"no element with given id in container"};
-            return SharedRef<T>{elem->second};
+            return getImpl(id);
         }
 
         SharedRef<TDerived> getImpl(uint32_t id) {
-            auto elem = container.find(id);
-            if(elem == container.end())
+            auto* entry = find(id);
+            if(!entry || !entry->object)
                 throw std::out_of_range{"no element with given id in container"};
 
-            return elem->second;
+            return entry->ref.lock();
         }
 
-        void iterate(std::function<void(TDerived&)> operation){
-            for(auto& obj: container)
-                operation(*(dynamic_cast<TDerived*>(obj.second.get())));
+        /** operation may create and release objects. Objects created meanwhile are visited as well */
+        template<typename Operation>
+        void iterate(Operation&& operation){
+            bool nested = iterating;
+            iterating = true;
+
+            // entries may be reallocated by operation, so they are accessed by position
+
+            for(size_t i = 0; i < entries.size(); ++i) {
+                if(auto* object = entries[i].object)
+                    operation(*object);
+            }
+
+            if(nested)
+                return;
+
+            iterating = false;
+
+            for(auto id: pendingErase)
+                erase(id);
+            pendingErase.clear();
         }
 
         void clear(){
-            container.clear();
+            entries.clear();
+            positions.clear();
         }
 
         size_t size() const{
-            return container.size();
+            return entries.size() - pendingErase.size();
         }
     };
 
@@ -153,10 +245,41 @@ namespace Vulgine {
         /** @brief Optional pNext structure for passing extension structures to device creation */
         void* deviceCreatepNextChain = nullptr;
 
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures{};
+
+        // VK_EXT_memory_budget is enabled, so VMA reports heap budget and usage of driver
+
+        bool memoryBudgetSupported = false;
+
+        // VK_KHR_draw_indirect_count is enabled, so indirect runs read their draw count from buffer. Null otherwise
+
+        PFN_vkCmdDrawIndexedIndirectCountKHR fpCmdDrawIndexedIndirectCount = nullptr;
+
 
 
         bool prepared = false;
 
+        // In headless mode swap chain images are replaced by engine-owned targets. Each target has
+        // host-visible buffer its content is copied to at the end of frame.
+
+        struct HeadlessTarget{
+            Memory::Image image;
+            Memory::Buffer readback;
+            void* mapped = nullptr;
+            uint64_t frame = 0;
+        };
+
+        std::vector<HeadlessTarget> headlessTargets;
+
+        // target rendered by each frame in flight, which is not delivered to user yet (-1 if none)
+
+        std::vector<int> headlessPendingTargets;
+
+        void createHeadlessTargets();
+        void destroyHeadlessTargets();
+        void recordHeadlessReadback(VkCommandBuffer buffer, int imageIndex);
+        void deliverHeadlessFrame(int frameSlot);
+
         /** @brief Pipeline stages used to wait at for graphics queue submissions */
         const VkPipelineStageFlags submitPipelineStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
 
@@ -168,10 +291,13 @@ namespace Vulgine {
             // Command buffer submission and execution
             VkSemaphore renderComplete;
 
-            VkFence inFlightSync;
+            // timeline value signaled by the last submission of this frame slot
+            uint64_t submitted = 0;
         };
 
-        std::vector<VkFence> swapChainFences;
+        // timeline value signaled by the last submission that used swap chain image (0 if none)
+
+        std::vector<uint64_t> imageTimelineValues;
         std::vector<FrameSyncObj> framesSync;
 
         UserInterface guiImpl;
@@ -183,11 +309,87 @@ namespace Vulgine {
         // Command buffers used for rendering
         std::vector<VkCommandBuffer> drawCmdBuffers;
 
+        struct CommandBufferState{
+            // recorded content doesn't match current engine state
+            bool outdated = true;
+            // recorded content refers to per-frame-in-flight resources, so it is valid for one frame only
+            bool frameDependent = false;
+            // some buffers referred by descriptor sets were replaced since this image was recorded
+            bool descriptorsOutdated = false;
+        };
+
+        std::vector<CommandBufferState> cmdBuffersState;
+
+        // Pools for secondary command buffers recorded by worker threads. There is a separate
+        // pool for each swap chain image and recording slot (one per worker + one for main thread),
+        // so no pool is ever accessed by two threads at once.
 
+        struct SecondaryCommandPool{
+            VkCommandPool pool = VK_NULL_HANDLE;
+            std::vector<VkCommandBuffer> buffers;
+            uint32_t used = 0;
+        };
+
+        std::vector<std::vector<SecondaryCommandPool>> secondaryPools;
+
+        MeshImpl* recordedHighlight = nullptr;
+
+        // Objects released by user (or engine) waiting for GPU to finish submissions that could use them.
+        // Entries are ordered by timeline value, since it never decreases. Objects retired since the last
+        // frame submission wait for value of the next one (UINT64_MAX until it's known).
+
+        struct RetiredObject{
+            uint64_t value = UINT64_MAX;
+            std::function<void()> destroy;
+        };
 
+        std::deque<RetiredObject> retiredObjects;
+        std::mutex retiredObjectsMutex;
+
+        // number of frames submitted to graphics queue so far
+
+        uint64_t submittedFrames = 0;
+
+        /** destroys every retired object GPU is done with by the time timeline reaches completedValue */
+        void destroyRetired(uint64_t completedValue);
+
+        /** ties objects retired since the last frame submission to timeline value of the frame just submitted */
+        void stampRetired(uint64_t frameValue);
+
+        // Replacements of static data waiting for their uploads. Old data stays in use until upload is
+        // done, so frames don't wait for transfer on GPU.
+
+        struct PendingSwap{
+            void const* owner = nullptr;
+            UploadToken token;
+            std::function<void()> swap;
+        };
+
+        std::vector<PendingSwap> pendingSwaps;
+
+        /** swaps in replacements whose uploads are done. Returns true if any of them was swapped */
+        bool applySwaps();
+
+        /** rewrites descriptors that refer to replaced buffers in sets used by image */
+        void refreshDescriptors(int imageIndex);
+
+        // Dynamic uniform buffers updated since data of swap chain image was last synchronized, per image.
+        // Buffer is listed at most once per image, see UniformBufferImpl::updated
+
+        std::vector<std::vector<UniformBufferImpl*>> dirtyUniformBuffers;
+
+        /** pushes data of dirty uniform buffers to image's section of uniform ring */
+        void syncUniformBuffers(int imageIndex);
+
+
+
+        bool initWindow();
         void createVkInstance();
         void createVulkanDevice();
         void createCommandBuffers();
+        void createSecondaryCommandPools();
+        void destroySecondaryCommandPools();
+        void resetSecondaryCommandPools(int imageIndex);
         void createSyncPrimitives();
         void destroySyncPrimitives();
         void setupSwapChain();
@@ -195,6 +397,7 @@ namespace Vulgine {
         void destroyDescriptorPools();
         void createCommandPool();
         void createPipelineCache();
+        void savePipelineCache();
         void destroyCommandBuffers();
         void recreateOnscreenFramebuffers();
         void destroyRenderPasses();
@@ -202,7 +405,6 @@ namespace Vulgine {
         void initFields();
         void renderFrame();
 
-        void buildRenderPass(RenderPassImplRef const& pass);
         void buildRenderPasses() override;
         void buildCommandBuffers(int imageIndex);
 
@@ -228,12 +430,55 @@ namespace Vulgine {
         // Depth buffer format (selected during Vulkan initialization)
         VkFormat depthFormat;
 
+        // set once during initialization, see Initializers::headless
+
+        bool headless = false;
+
+        /** layout onscreen pass leaves swap chain image (or headless target) in */
+        VkImageLayout onscreenFinalLayout() const { return headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;};
+
         struct Settings{
             bool vsync = false;
             VkSampleCountFlagBits msaa = VK_SAMPLE_COUNT_1_BIT;
             uint32_t framesInFlight = 2;
+            bool reuseCommandBuffers = true;
+            uint32_t recordingThreads = 1;
+            uint32_t minMeshesPerRecordingThread = 256;
+            bool autoInstancing = true;
+            bool indirectDraws = true;
+            uint32_t stagingRingSize = 64 * 1024 * 1024;
+            uint32_t geometryBlockSize = 64 * 1024 * 1024;
+            uint32_t defragmentationBytesPerFrame = 16 * 1024 * 1024;
+            uint32_t uniformRingSize = 256 * 1024;
         } settings;
 
+        ThreadPool recordingThreads;
+
+        GPUProfiler gpuProfiler;
+
+        // GPU progress of every engine submission
+
+        Timeline timeline;
+
+        Uploader uploader;
+
+        Defragmenter defragmenter;
+
+        // static vertex (and instance) data and indices of all meshes
+
+        Memory::BufferPool vertexPool;
+        Memory::BufferPool indexPool;
+
+        // data of all dynamic uniform buffers, uniformRingSize bytes per swap chain image initially
+
+        Memory::UniformRing uniformRing;
+
+        /** submits one-time command buffer allocated from device command pool and waits until it's executed */
+        void flushCommandBuffer(VkCommandBuffer commandBuffer);
+
+        /** returns secondary buffer of given recording slot ready to record commands within pass subpass */
+        VkCommandBuffer beginSecondaryCommandBuffer(int imageIndex, uint32_t slot, RenderPassImpl* pass, uint32_t subpass);
+
         // User input functions called by active window input listener functions
 
         void keyDown(Window* window, int key);
@@ -251,6 +496,10 @@ namespace Vulgine {
         std::map<std::string, ShaderModule> vertexShaders;
         std::map<std::string, ShaderModule> fragmentShaders;
 
+        // created descriptor sets, so those referring to replaced buffers can be rewritten
+
+        std::unordered_set<DescriptorSet*> descriptorSets;
+
         IdentifiableContainer<Scene, SceneImpl> scenes;
         IdentifiableContainer<Material, MaterialImpl> materials;
         IdentifiableContainer<Image, StaticImageImpl> images;
@@ -268,14 +517,48 @@ namespace Vulgine {
         struct PipelineMap{
 
 
-            std::map<PipelineKey , GeneralPipeline> map;
+            struct Entry{
+                GeneralPipeline pipeline;
+                std::atomic<bool> ready = false;
+
+                explicit Entry(PipelineKey key): pipeline(key){}
+            };
 
+            std::map<PipelineKey , Entry> map;
+
+            // pipelines may be requested from several recording threads at once
+            std::mutex mutex;
+
+            // If enabled, pipelines are compiled by background threads, so
+            // first appearance of new geometry/material combination doesn't stall recording
+
+            bool async = true;
+            ThreadPool compiler;
+
+            // set by compiler threads when at least one pipeline became ready since last poll
+
+            std::atomic<bool> newPipelinesReady = false;
+
+            /** requests pipeline creation without binding it. May be used to warm up pipelines in advance */
             void add(PipelineKey key);
 
-            GeneralPipeline const& bind(PipelineKey key, VkCommandBuffer cmdBuffer);
+            /** returns pipeline if it is ready, nullptr if it is still being compiled, so draw must be skipped */
+            GeneralPipeline const* get(PipelineKey key);
+
+            /** binds pipeline if it is ready. Returns nullptr if pipeline is still being compiled, so draw must be skipped */
+            GeneralPipeline const* bind(PipelineKey key, VkCommandBuffer cmdBuffer);
+
+            /** returns true if any pipeline finished compilation since last call */
+            bool pollReady() { return newPipelinesReady.exchange(false);};
 
             void clear();
 
+            /** destroys every pipeline that was built for given object */
+            void forget(ObjectImpl* object);
+
+        private:
+            Entry& request(PipelineKey key);
+
         } pipelineMap;
 
         VulkanSwapChain swapChain;
@@ -297,14 +580,32 @@ namespace Vulgine {
 
         IdentifiableContainer<RenderPass, RenderPassImpl> renderPasses;
         std::deque<RenderPassImplRef> renderPassLine;
+        RenderGraph renderGraph;
 
         RenderPassImplRef onscreenRenderPass = nullptr;
         MaterialRef highlightMaterial = nullptr;
 
         GUI gui;
 
+        // Set to invalidate command buffers of all swap chain images. They will be re-recorded lazily.
+
         bool cmdBuffersOutdated = false;
 
+        // Incremented each time command buffers get outdated. Draw packets compiled for older revision
+        // are compiled again before they are recorded
+
+        uint64_t drawRevision = 1;
+
+        // Set during command buffer recording if any of commands refer to per-frame-in-flight resources
+
+        std::atomic<bool> frameDependentCommands = false;
+
+        // Binds recorded and binds elided as redundant during the last command buffer build, summed over its
+        // secondary buffers
+
+        std::atomic<uint32_t> recordedBinds = 0;
+        std::atomic<uint32_t> elidedBinds = 0;
+
 
         SceneRef initNewScene() override;
 
@@ -327,8 +628,23 @@ namespace Vulgine {
         bool initialize();
         void terminate();
 
+        /** schedules destroy call after GPU finishes all frames submitted so far and the one being recorded now */
+        void retire(std::function<void()> destroy);
+
+        /** calls swap on main thread, before command buffers are recorded, once upload of token is done.
+         *  Owner has at most one pending swap, new one replaces the previous */
+        void swapWhenUploaded(void const* owner, UploadToken token, std::function<void()> swap);
+
+        /** drops pending swap of owner if there is any */
+        void cancelSwap(void const* owner);
+
         bool cycle() override;
         double lastFrameTime() const override;
+        bool exportGPUTrace(const char* filename) override;
+        bool exportCPUTrace(const char* filename) override;
+        MemoryStatistics memoryStatistics() override;
+        bool exportMemoryStatistics(const char* filename) override;
+        void defragmentMemory() override;
         void updateMSAA(VkSampleCountFlagBits newValue);
         void toggleVsync();
 
@@ -0,0 +1,135 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#include "VulgineCPUProfiler.h"
+#include "Utilities.h"
+#include <chrono>
+#include <fstream>
+#include <algorithm>
+
+namespace Vulgine{
+
+    std::atomic<bool> CPUProfiler::enabled = true;
+    std::mutex CPUProfiler::registryMutex;
+    std::deque<std::unique_ptr<CPUProfiler::ThreadRing>> CPUProfiler::rings;
+
+    uint64_t CPUProfiler::now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    namespace {
+        thread_local CPUProfiler::ThreadRing* currentRing = nullptr;
+        thread_local std::string currentThreadName;
+    }
+
+    CPUProfiler::ThreadRing &CPUProfiler::threadRing() {
+        if(!currentRing){
+            std::lock_guard<std::mutex> lock{registryMutex};
+            rings.emplace_back(std::make_unique<ThreadRing>());
+            currentRing = rings.back().get();
+            currentRing->index = rings.size() - 1;
+            currentRing->name = currentThreadName.empty() ? "Thread #" + std::to_string(currentRing->index) : currentThreadName;
+        }
+
+        return *currentRing;
+    }
+
+    void CPUProfiler::setThreadName(std::string const& name) {
+
+        // ring is registered lazily, by first zone of the thread
+
+        currentThreadName = name;
+
+        if(currentRing){
+            std::lock_guard<std::mutex> lock{registryMutex};
+            currentRing->name = name;
+        }
+    }
+
+    void CPUProfiler::ThreadRing::copy(std::vector<Event>& dst, uint64_t since) const {
+        uint64_t last = head.load(std::memory_order_acquire);
+        uint64_t first = last > ringSize ? last - ringSize : 0;
+
+        for(uint64_t i = first; i < last; ++i){
+            auto const& slot = slots[i % ringSize];
+            uint64_t done = 2 * i + 2;
+
+            // writer may have lapped us: slot is being written or already holds a newer event
+
+            if(slot.sequence.load(std::memory_order_acquire) != done)
+                continue;
+
+            Event event{slot.name.load(std::memory_order_relaxed), slot.start.load(std::memory_order_relaxed),
+                        slot.end.load(std::memory_order_relaxed), slot.depth.load(std::memory_order_relaxed)};
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            if(slot.sequence.load(std::memory_order_relaxed) != done)
+                continue;
+
+            if(event.end >= since)
+                dst.push_back(event);
+        }
+    }
+
+    std::vector<CPUProfiler::ThreadEvents> CPUProfiler::snapshot(uint64_t since) {
+        std::vector<ThreadEvents> ret;
+
+        std::lock_guard<std::mutex> lock{registryMutex};
+
+        for(auto const& ring: rings){
+            ThreadEvents thread{ring->index, ring->name, {}};
+            ring->copy(thread.events, since);
+            if(!thread.events.empty())
+                ret.emplace_back(std::move(thread));
+        }
+
+        return ret;
+    }
+
+    bool CPUProfiler::exportTrace(std::string const& filename) {
+        auto threads = snapshot();
+
+        std::ofstream os(filename, std::ios::out | std::ios::trunc);
+
+        if(!os.is_open()){
+            errs("CPU profiler: could not open trace file " + filename);
+            return false;
+        }
+
+        uint64_t base = UINT64_MAX;
+        for(auto const& thread: threads)
+            for(auto const& event: thread.events)
+                base = std::min(base, event.start);
+
+        // complete ("X") events with microsecond timestamps, one trace thread per profiled thread
+
+        os << std::fixed;
+        os.precision(3);
+
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        bool first = true;
+        for(auto const& thread: threads){
+            if(!first)
+                os << ",";
+            first = false;
+
+            os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread.thread
+               << ",\"args\":{\"name\":\"" << Utilities::escapeJSON(thread.name) << "\"}}";
+
+            for(auto const& event: thread.events){
+                os << ",{\"name\":\"" << Utilities::escapeJSON(event.name) << "\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":1,\"tid\":" << thread.thread
+                   << ",\"ts\":" << static_cast<double>(event.start - base) / 1000.0
+                   << ",\"dur\":" << static_cast<double>(event.end - event.start) / 1000.0 << "}";
+            }
+        }
+
+        os << "]}";
+
+        logger("CPU profiler: trace of " + std::to_string(threads.size()) + " threads written to " + filename);
+
+        return os.good();
+    }
+}
@@ -0,0 +1,144 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINECPUPROFILER_H
+#define TEST_EXE_VULGINECPUPROFILER_H
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Vulgine{
+
+    /**
+     * Collects CPU zones marked with VULGINE_PROFILE_ZONE.
+     *
+     * Every thread writes finished zones into its own ring buffer, so recording takes no locks. Ring
+     * buffers are registered once per thread and live as long as the program, so they may be read
+     * after their thread has exited. Readers copy ring contents and drop entries that writer
+     * was writing or has overwritten during copy.
+     * */
+
+    class CPUProfiler{
+    public:
+        struct Event{
+            const char* name;   // must be string literal (or otherwise outlive profiler)
+            uint64_t start;     // nanoseconds, see now()
+            uint64_t end;
+            uint32_t depth;
+        };
+
+        // zones recorded by one thread, ordered by end time
+
+        struct ThreadEvents{
+            uint32_t thread;
+            std::string name;
+            std::vector<Event> events;
+        };
+
+        static constexpr const uint32_t ringSize = 1u << 14;
+
+        class ThreadRing{
+
+            // Slot of event pushed at position p has sequence 2p + 1 while it's written and 2p + 2 once it's
+            // done, so readers tell torn and overwritten slots. Fields are read concurrently with writes, so
+            // they are atomics too
+
+            struct Slot{
+                std::atomic<uint64_t> sequence = 0;
+                std::atomic<const char*> name = nullptr;
+                std::atomic<uint64_t> start = 0;
+                std::atomic<uint64_t> end = 0;
+                std::atomic<uint32_t> depth = 0;
+            };
+
+            std::array<Slot, ringSize> slots;
+            std::atomic<uint64_t> head = 0;
+        public:
+            uint32_t depth = 0;
+            uint32_t index = 0;
+            std::string name;
+
+            void push(Event const& event){
+                uint64_t pos = head.load(std::memory_order_relaxed);
+                auto& slot = slots[pos % ringSize];
+
+                slot.sequence.store(2 * pos + 1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+
+                slot.name.store(event.name, std::memory_order_relaxed);
+                slot.start.store(event.start, std::memory_order_relaxed);
+                slot.end.store(event.end, std::memory_order_relaxed);
+                slot.depth.store(event.depth, std::memory_order_relaxed);
+
+                slot.sequence.store(2 * pos + 2, std::memory_order_release);
+                head.store(pos + 1, std::memory_order_release);
+            }
+
+            void copy(std::vector<Event>& dst, uint64_t since) const;
+        };
+
+        static std::atomic<bool> enabled;
+
+        static uint64_t now();
+
+        /** ring of calling thread, registered on first call */
+        static ThreadRing& threadRing();
+
+        static void setThreadName(std::string const& name);
+
+        /** copies zones that ended not earlier than since */
+        static std::vector<ThreadEvents> snapshot(uint64_t since = 0);
+
+        /** writes zones still present in rings as Chrome trace event JSON */
+        static bool exportTrace(std::string const& filename);
+
+    private:
+        static std::mutex registryMutex;
+        static std::deque<std::unique_ptr<ThreadRing>> rings;
+    };
+
+    class ScopedCPUZone{
+        CPUProfiler::ThreadRing* ring = nullptr;
+        const char* name;
+        uint64_t start = 0;
+    public:
+        explicit ScopedCPUZone(const char* zoneName): name(zoneName){
+            if(!CPUProfiler::enabled.load(std::memory_order_relaxed))
+                return;
+
+            ring = &CPUProfiler::threadRing();
+            ring->depth++;
+            start = CPUProfiler::now();
+        }
+
+        ScopedCPUZone(ScopedCPUZone const&) = delete;
+        ScopedCPUZone& operator=(ScopedCPUZone const&) = delete;
+
+        ~ScopedCPUZone(){
+            if(!ring)
+                return;
+
+            uint64_t end = CPUProfiler::now();
+            ring->depth--;
+            ring->push({name, start, end, ring->depth});
+        }
+    };
+}
+
+// Zones are compiled out unless VULGINE_CPU_PROFILER is defined (see VULGINE_CPU_PROFILER CMake option)
+
+#ifdef VULGINE_CPU_PROFILER
+#define VULGINE_PROFILE_CONCAT_IMPL(a, b) a##b
+#define VULGINE_PROFILE_CONCAT(a, b) VULGINE_PROFILE_CONCAT_IMPL(a, b)
+#define VULGINE_PROFILE_ZONE(name) ::Vulgine::ScopedCPUZone VULGINE_PROFILE_CONCAT(vulgineProfileZone, __LINE__){name}
+#else
+#define VULGINE_PROFILE_ZONE(name)
+#endif
+
+#endif //TEST_EXE_VULGINECPUPROFILER_H
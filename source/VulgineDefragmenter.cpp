@@ -0,0 +1,288 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#include "VulgineDefragmenter.h"
+#include "Vulgine.h"
+#include "VulgineObjects.h"
+#include "VulgineImage.h"
+#include "Utilities.h"
+#include "vulkan/VulkanInitializers.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace Vulgine{
+
+    namespace {
+
+        void recordImageBarrier(VkCommandBuffer commandBuffer, VkImage image, VkImageSubresourceRange const& range,
+                                VkImageLayout oldLayout, VkImageLayout newLayout,
+                                VkAccessFlags srcAccess, VkAccessFlags dstAccess){
+            VkImageMemoryBarrier barrier = initializers::imageMemoryBarrier();
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.image = image;
+            barrier.subresourceRange = range;
+            barrier.oldLayout = oldLayout;
+            barrier.newLayout = newLayout;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstAccessMask = dstAccess;
+
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                                 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+    }
+
+    void Defragmenter::start() {
+        if(running)
+            return;
+
+        running = true;
+        visited.clear();
+        movedBytes = 0;
+
+        logger("Defragmentation started");
+    }
+
+    VkDeviceSize Defragmenter::blockBytes() {
+        auto& vlg = GetImpl();
+
+        const VkPhysicalDeviceMemoryProperties* memoryProperties;
+        vmaGetMemoryProperties(vlg.allocator, &memoryProperties);
+
+        std::vector<VmaBudget> budgets(memoryProperties->memoryHeapCount);
+        vmaGetBudget(vlg.allocator, budgets.data());
+
+        VkDeviceSize ret = 0;
+
+        for(auto const& budget: budgets)
+            ret += budget.blockBytes;
+
+        return ret;
+    }
+
+    bool Defragmenter::relocate(Memory::Image &image, Memory::Image &target, VkCommandBuffer commandBuffer) {
+        auto& vlg = GetImpl();
+
+        auto before = blockBytes();
+
+        target.allocate(image.imageInfo, VMA_MEMORY_USAGE_GPU_ONLY, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VmaAllocationInfo from;
+        VmaAllocationInfo to;
+        vmaGetAllocationInfo(vlg.allocator, image.allocation, &from);
+        vmaGetAllocationInfo(vlg.allocator, target.allocation, &to);
+
+        // image moved within its block or into a new one doesn't let any block go
+
+        if(blockBytes() > before || to.deviceMemory == from.deviceMemory){
+            target.free();
+            return false;
+        }
+
+        VkImageSubresourceRange range{};
+        range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        range.levelCount = image.imageInfo.mipLevels;
+        range.layerCount = image.imageInfo.arrayLayers;
+
+        recordImageBarrier(commandBuffer, image.image, range, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           0, VK_ACCESS_TRANSFER_READ_BIT);
+        recordImageBarrier(commandBuffer, target.image, range, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           0, VK_ACCESS_TRANSFER_WRITE_BIT);
+
+        std::vector<VkImageCopy> regions;
+
+        for(uint32_t level = 0; level < image.imageInfo.mipLevels; ++level){
+            auto& region = regions.emplace_back();
+            region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.srcSubresource.mipLevel = level;
+            region.srcSubresource.layerCount = image.imageInfo.arrayLayers;
+            region.dstSubresource = region.srcSubresource;
+            region.extent.width = std::max(image.imageInfo.extent.width >> level, 1u);
+            region.extent.height = std::max(image.imageInfo.extent.height >> level, 1u);
+            region.extent.depth = std::max(image.imageInfo.extent.depth >> level, 1u);
+        }
+
+        vkCmdCopyImage(commandBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       regions.size(), regions.data());
+
+        // old image is destroyed afterwards, so only the new one is made ready for sampling
+
+        recordImageBarrier(commandBuffer, target.image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                           VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+
+        return true;
+    }
+
+    bool Defragmenter::step(VkDeviceSize maxBytes) {
+        if(!running)
+            return false;
+
+        VULGINE_PROFILE_ZONE("defragmentation step");
+
+        auto& vlg = GetImpl();
+
+        // uploads into resources being moved must be submitted before the copies, so they are executed first
+
+        vlg.uploader.flush();
+
+        VkCommandBuffer commandBuffer = vlg.device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+
+        // frames submitted so far may read resources being moved, as well as memory they are moved to
+
+        VkMemoryBarrier barrier = initializers::memoryBarrier();
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        VkDeviceSize budget = maxBytes;
+
+        // Images are relocated first: nothing may be allocated between VMA defragmentation begin and end
+
+        std::vector<std::pair<Memory::Image*, std::unique_ptr<Memory::Image>>> movedImages;
+        bool imagesLeft = false;
+
+        vlg.images.iterate([&](StaticImageImpl& image){
+            if(!image.image.allocated || visited.count(image.id()))
+                return;
+
+            auto size = image.image.allocationSize();
+
+            // image larger than the whole budget is moved alone
+
+            if(size > budget && budget < maxBytes){
+                imagesLeft = true;
+                return;
+            }
+
+            visited.insert(image.id());
+
+            auto target = std::make_unique<Memory::Image>();
+
+            if(relocate(image.image, *target, commandBuffer)) {
+                movedImages.emplace_back(&image.image, std::move(target));
+                budget -= std::min(budget, size);
+            }
+        });
+
+        // VMA is given every static buffer, it decides what to move within budget
+
+        std::vector<Memory::Buffer*> buffers;
+        std::vector<VmaAllocation> allocations;
+
+        vlg.uniformBuffers.iterate([&buffers, &allocations](UniformBufferImpl& ubo){
+            if(ubo.dynamic || ubo.buffers.empty() || !ubo.buffers.back()->allocated)
+                return;
+
+            buffers.push_back(ubo.buffers.back());
+            allocations.push_back(ubo.buffers.back()->allocation);
+        });
+
+        std::vector<VkBool32> changed(allocations.size(), VK_FALSE);
+        VmaDefragmentationContext context = VK_NULL_HANDLE;
+        VmaDefragmentationStats stats{};
+
+        bool buffersTried = allocations.empty();
+
+        if(!allocations.empty() && budget > 0){
+            buffersTried = true;
+
+            VmaDefragmentationInfo2 info{};
+            info.allocationCount = allocations.size();
+            info.pAllocations = allocations.data();
+            info.pAllocationsChanged = changed.data();
+            info.maxCpuBytesToMove = 0;
+            info.maxCpuAllocationsToMove = 0;
+            info.maxGpuBytesToMove = budget;
+            info.maxGpuAllocationsToMove = UINT32_MAX;
+            info.commandBuffer = commandBuffer;
+
+            // VK_NOT_READY means copies are recorded and context must be ended after they are executed
+
+            VkResult result = vmaDefragmentationBegin(vlg.allocator, &info, &stats, &context);
+            if(result != VK_SUCCESS && result != VK_NOT_READY)
+                Utilities::ExitFatal(result, "VMA defragmentation failed: " + Utilities::errorString(result));
+        }
+
+        // next frames may use moved data in any way
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        vlg.flushCommandBuffer(commandBuffer);
+
+        if(context != VK_NULL_HANDLE)
+            vmaDefragmentationEnd(vlg.allocator, context);
+
+        // Handles are replaced, objects stay. Old handles are retired, as command buffers
+        // recorded for other swap chain images still refer to them
+
+        uint32_t movedBuffers = 0;
+
+        for(size_t i = 0; i < buffers.size(); ++i){
+            if(!changed.at(i))
+                continue;
+
+            auto* buffer = buffers.at(i);
+            auto oldBuffer = buffer->buffer;
+
+            vlg.retire([oldBuffer](){
+                vkDestroyBuffer(GetImpl().device->logicalDevice, oldBuffer, nullptr);
+            });
+
+            VK_CHECK_RESULT(vkCreateBuffer(vlg.device->logicalDevice, &buffer->bufferInfo, nullptr, &buffer->buffer))
+            VK_CHECK_RESULT(vmaBindBufferMemory(vlg.allocator, buffer->allocation, buffer->buffer))
+
+            movedBuffers++;
+        }
+
+        for(auto& moved: movedImages){
+            auto* image = moved.first;
+            auto& target = *moved.second;
+
+            auto oldImage = image->image;
+            auto oldAllocation = image->allocation;
+
+            vlg.retire([oldImage, oldAllocation](){
+                vmaDestroyImage(GetImpl().allocator, oldImage, oldAllocation);
+            });
+
+            image->image = target.image;
+            image->allocation = target.allocation;
+
+            target.image = VK_NULL_HANDLE;
+            target.allocated = false;
+
+            movedBytes += image->allocationSize();
+
+            // GPU is done with all frames submitted so far, so gui descriptor may be replaced at once
+
+            vlg.gui.refreshTexturedImage(image);
+        }
+
+        movedBytes += stats.bytesMoved;
+
+        bool moved = movedBuffers > 0 || !movedImages.empty();
+
+        if(moved){
+            for(auto& state: vlg.cmdBuffersState)
+                state.descriptorsOutdated = true;
+        }
+
+        // run is over once every image was visited and VMA has nothing more to move
+
+        if(!imagesLeft && buffersTried && movedBuffers == 0){
+            running = false;
+            logger("Defragmentation finished: " + std::to_string(movedBytes / 1024) + " KiB moved, " +
+                   std::to_string(stats.deviceMemoryBlocksFreed) + " blocks freed by the last step");
+        }
+
+        return moved;
+    }
+}
@@ -0,0 +1,57 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINEDEFRAGMENTER_H
+#define TEST_EXE_VULGINEDEFRAGMENTER_H
+
+#include "vulkan/vulkan.h"
+#include <unordered_set>
+
+namespace Vulgine{
+
+    namespace Memory{
+        struct Image;
+    }
+
+    /**
+     * Compacts memory of long-lived resources: static uniform buffers and static (sampled) images.
+     *
+     * Run is started on demand and moves a limited amount of bytes each frame, until every resource
+     * was visited once. Buffers are moved by VMA defragmentation, which copies them within its blocks.
+     * VMA can't move optimally tiled images, so each image is copied to a new allocation instead, if it
+     * fits into free space of existing blocks.
+     *
+     * Moved resources keep their Memory::Buffer/Memory::Image objects, only handles inside of them are
+     * replaced. Descriptor sets referring to them are rewritten per image before it is recorded again.
+     *
+     * Copies are executed by graphics queue after frames submitted so far, and step waits for them,
+     * as VMA requires defragmentation to be finished before its allocator is used again.
+     * */
+
+    class Defragmenter{
+        bool running = false;
+
+        // objects visited by current run, each is moved at most once
+
+        std::unordered_set<uint32_t> visited;
+
+        VkDeviceSize movedBytes = 0;
+
+        /** allocates new place of image in free space of existing blocks and records copy into it.
+         *  Returns false if image would need new block */
+        static bool relocate(Memory::Image& image, Memory::Image& target, VkCommandBuffer commandBuffer);
+
+        static VkDeviceSize blockBytes();
+
+    public:
+
+        void start();
+
+        bool active() const { return running;};
+
+        /** moves next portion of resources. Returns true if any of them was moved */
+        bool step(VkDeviceSize maxBytes);
+    };
+}
+#endif //TEST_EXE_VULGINEDEFRAGMENTER_H
@@ -5,6 +5,7 @@
 #include "VulgineDescriptorSet.h"
 #include "VulgineObjects.h"
 #include "Vulgine.h"
+#include <array>
 
 void Vulgine::DescriptorSet::createImpl() {
     assert(pool && "Descriptor pool must be specified for descriptor set before create() invocation");
@@ -17,6 +18,7 @@ void Vulgine::DescriptorSet::createImpl() {
         writes.reserve(set.descriptors.size());
 
         int i = 0;
+        uint32_t dynamicCount = 0;
         for(auto* descriptor: set.descriptors){
             VkWriteDescriptorSet write;
             VkDescriptorSetLayoutBinding binding{};
@@ -26,7 +28,7 @@ void Vulgine::DescriptorSet::createImpl() {
             binding.pImmutableSamplers = nullptr;
 
             switch(descriptor->descriptorType){
-                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER:
+                case VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC: dynamicCount++; break;
                 case VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT:
                 case VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER: break;
                 default: assert(0 && "Descriptor type isn't supported");
@@ -41,21 +43,38 @@ void Vulgine::DescriptorSet::createImpl() {
             i++;
         }
 
+        assert(dynamicCount <= maxDynamicDescriptors && "Too many uniform buffers in one descriptor set");
+
         set.set = pool->allocateSet(bindings.data(), bindings.size());
         pool->updateDescriptor(set.set, writes);
     }
+
+    // buffers behind descriptors may be replaced later (e.g. static ubo update)
+
+    GetImpl().descriptorSets.insert(this);
 }
 
 void Vulgine::DescriptorSet::destroyImpl() {
     //assert(0 && "cannot deallocate descriptor Sets individually yet");
+    GetImpl().descriptorSets.erase(this);
 }
 
 Vulgine::DescriptorSet::~DescriptorSet() {
+    GetImpl().descriptorSets.erase(this);
     clearDescriptors();
 }
 
 void Vulgine::DescriptorSet::bind(uint32_t set, VkCommandBuffer buffer, VkPipelineLayout layout, VkPipelineBindPoint bindPoint,uint32_t currentFrame) {
-    pool->bind(buffer, bindPoint, layout, set, sets.at(currentFrame).set);
+    auto const& bound = sets.at(currentFrame);
+
+    std::array<uint32_t, maxDynamicDescriptors> offsets{};
+    uint32_t offsetCount = 0;
+
+    for(auto* descriptor: bound.descriptors)
+        if(descriptor->descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC)
+            offsets.at(offsetCount++) = descriptor->dynamicOffset(currentFrame);
+
+    pool->bind(buffer, bindPoint, layout, set, bound.set, offsetCount, offsets.data());
 }
 
 void Vulgine::DescriptorSet::clearDescriptors() {
@@ -104,12 +123,11 @@ void Vulgine::DescriptorSet::addUniformBuffer(UniformBufferRef const& buffer, Vk
 
     if(buffer->dynamic){
         auto& ubo = *dynamic_cast<UniformBufferImpl*>(buffer.get());
-        int i = 0;
+        auto& ring = GetImpl().uniformRing;
         for(auto& set: sets){
-            auto* desc = set.descriptors.emplace_back(new DUniformBuffer{ubo.buffers.at(i)});
+            auto* desc = set.descriptors.emplace_back(new DUniformBuffer{&ring, ubo.slot, ubo.size});
             desc->stage = stage;
             desc->setupDescriptor();
-            i++;
         }
 
     } else {
@@ -144,6 +162,30 @@ void Vulgine::DescriptorSet::freeSets() {
     for(auto const& set: sets)
         pool->freeSet(set.set);
 
+    GetImpl().descriptorSets.erase(this);
+
     clearDescriptors();
 }
 
+void Vulgine::DescriptorSet::refresh(uint32_t image) {
+    if(image >= sets.size() || sets.at(image).set == UINT32_MAX)
+        return;
+
+    auto& set = sets.at(image);
+
+    std::vector<VkWriteDescriptorSet> writes;
+
+    int i = 0;
+    for(auto* descriptor: set.descriptors){
+        if(descriptor->outdated()){
+            descriptor->destroyDescriptor();
+            descriptor->setupDescriptor();
+            writes.push_back(descriptor->write(i));
+        }
+        i++;
+    }
+
+    if(!writes.empty())
+        pool->updateDescriptor(set.set, writes);
+}
+
@@ -20,6 +20,10 @@ namespace Vulgine{
         };
         std::vector<Set> sets;
 
+        // Vulkan guarantees at least 8 dynamic uniform buffers per pipeline layout
+
+        static constexpr const uint32_t maxDynamicDescriptors = 8;
+
 
     protected:
         void createImpl() override;
@@ -47,6 +51,9 @@ namespace Vulgine{
 
         void freeSets();
 
+        /** rewrites descriptors of image's set whose resources were replaced. Image's command buffer must not be in use */
+        void refresh(uint32_t image);
+
         ~DescriptorSet() override;
     };
 }
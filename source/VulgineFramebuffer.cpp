@@ -93,7 +93,8 @@ void Vulgine::FrameBufferImpl::addOnsrceenAttachment(std::vector<VkImageView> co
         attachments.at(i).push_back(views.at(i));
 }
 
-Vulgine::ImageRef Vulgine::FrameBufferImpl::createAttachment(VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits samples) {
+Vulgine::ImageRef Vulgine::FrameBufferImpl::createAttachment(VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits samples,
+                                                              bool transient) {
     attachments.resize(GetImpl().swapChain.imageCount);
 
     auto const& renderPassRef = *(renderPass.lock().get());
@@ -122,48 +123,97 @@ Vulgine::ImageRef Vulgine::FrameBufferImpl::createAttachment(VkFormat format, Vk
     imageInfo.flags = 0; // Optional
 
     image->createInfo = imageInfo;
+    image->transient = transient;
     image->create();
+
+    if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+        hasDepth = true;
+
+    // create on view per every swap chain image. Transient images have no memory yet, their views are
+    // created later by createTransientViews()
+
+    for(int i = 0; i < GetImpl().swapChain.imageCount; ++i)
+        attachments.at(i).push_back(transient ? VK_NULL_HANDLE : createView(*image, i));
+
+    return image;
+
+}
+
+VkImageView Vulgine::FrameBufferImpl::createView(DynamicImageImpl const& image, uint32_t index) const {
     VkImageAspectFlags aspectMask = 0;
 
-    if (usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+    if (image.createInfo.usage & VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
     {
         aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
     }
-    if (usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
+    if (image.createInfo.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)
     {
-        hasDepth = true;
         aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
     }
-    // create on view per every swap chain image
-    for(int i = 0; i < GetImpl().swapChain.imageCount; ++i) {
-        VkImageView view;
-        VkImageViewCreateInfo viewCreateInfo = {};
-        viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        viewCreateInfo.format = imageInfo.format;
-        viewCreateInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B,
-                                     VK_COMPONENT_SWIZZLE_A};
-
-        // TODO: also make handle for stencil view aspect
-
-        viewCreateInfo.subresourceRange = {aspectMask, 0, 1, 0, 1};
-        // Linear tiling usually won't support mip maps
-        // Only set mip map count if optimal tiling is used
-        viewCreateInfo.subresourceRange.levelCount = 1;
-        viewCreateInfo.image = image->images.at(i).image;
-        VK_CHECK_RESULT(vkCreateImageView(GetImpl().device->logicalDevice, &viewCreateInfo, nullptr, &view));
-        attachments.at(i).push_back(view);
+
+    VkImageView view;
+    VkImageViewCreateInfo viewCreateInfo = {};
+    viewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewCreateInfo.format = image.createInfo.format;
+    viewCreateInfo.components = {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B,
+                                 VK_COMPONENT_SWIZZLE_A};
+
+    // TODO: also make handle for stencil view aspect
+
+    viewCreateInfo.subresourceRange = {aspectMask, 0, 1, 0, 1};
+    // Linear tiling usually won't support mip maps
+    // Only set mip map count if optimal tiling is used
+    viewCreateInfo.subresourceRange.levelCount = 1;
+    viewCreateInfo.image = image.images.at(index).image;
+    VK_CHECK_RESULT(vkCreateImageView(GetImpl().device->logicalDevice, &viewCreateInfo, nullptr, &view));
+
+    return view;
+}
+
+std::vector<Vulgine::DynamicImageImpl*> Vulgine::FrameBufferImpl::transientAttachments() {
+    std::vector<DynamicImageImpl*> ret;
+
+    if(attachments.empty())
+        return ret;
+
+    for(uint32_t binding = 0; binding < attachments.at(0).size(); ++binding){
+        auto it = attachmentsImages.find(binding);
+        if(it != attachmentsImages.end() && it->second->transient)
+            ret.push_back(it->second.get());
+    }
+
+    return ret;
+}
+
+void Vulgine::FrameBufferImpl::createTransientViews() {
+    for(auto& it: attachmentsImages){
+        if(!it.second->transient)
+            continue;
+
+        for(int i = 0; i < GetImpl().swapChain.imageCount; ++i) {
+            auto& view = attachments.at(i).at(it.first);
+            if(view == VK_NULL_HANDLE)
+                view = createView(*it.second, i);
+        }
     }
+}
 
-    return image;
+void Vulgine::FrameBufferImpl::createTransientDepth(VkSampleCountFlagBits samples) {
+    if(hasDepth){
+        errs("Cannot bind more than one depth attachment to framebuffer");
+        return;
+    }
 
+    createAttachment(GetImpl().device->getSupportedDepthFormat(true),
+                     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, samples, true);
 }
 
 void Vulgine::FrameBufferImpl::createGBuffer() {
 
-    createAttachment(GBufferPosFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);	// (World space) Positions
-    createAttachment(GBufferNormFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);		// (World space) Normals
-    createAttachment(GBufferAlbedoFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT);			// Albedo (color)
+    createAttachment(GBufferPosFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, true);	// (World space) Positions
+    createAttachment(GBufferNormFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, true);		// (World space) Normals
+    createAttachment(GBufferAlbedoFormat, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, VK_SAMPLE_COUNT_1_BIT, true);			// Albedo (color)
 
 }
 
@@ -15,11 +15,14 @@ namespace Vulgine{
 
     class FrameBufferImpl: public ObjectImplNoMove{
         bool hasDepth = false;
+
+        VkImageView createView(DynamicImageImpl const& image, uint32_t index) const;
     protected:
         void createImpl() override;
         void destroyImpl() override;
     public:
-        ImageRef createAttachment(VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+        ImageRef createAttachment(VkFormat format, VkImageUsageFlags usage, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT,
+                                  bool transient = false);
 
 
         static const VkFormat GBufferAlbedoFormat = VK_FORMAT_R8G8B8A8_UNORM;
@@ -36,6 +39,15 @@ namespace Vulgine{
         void addOnsrceenAttachment(std::vector<VkImageView> const& views);
         void createGBuffer();
 
+        /** depth target used only within render pass */
+        void createTransientDepth(VkSampleCountFlagBits samples);
+
+        /** transient attachments ordered by binding */
+        std::vector<DynamicImageImpl*> transientAttachments();
+
+        /** must be called once transient attachments are bound to memory */
+        void createTransientViews();
+
         uint32_t attachmentCount();
         uint32_t colorAttachmentCount();
 
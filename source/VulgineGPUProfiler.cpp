@@ -0,0 +1,210 @@
+//
+// Created by Бушев Дмитрий on 04.08.2021.
+//
+
+#include "VulgineGPUProfiler.h"
+#include <cassert>
+#include "Utilities.h"
+#include <fstream>
+
+namespace Vulgine{
+
+    void GPUProfiler::create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamily, uint32_t imageCount) {
+        device = logicalDevice;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+        uint32_t validBits = families.at(queueFamily).timestampValidBits;
+
+        supported = validBits != 0 && properties.limits.timestampPeriod > 0.0f;
+
+        if(!supported){
+            logger("GPU profiler: timestamps are not supported by graphics queue");
+            return;
+        }
+
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+        VkQueryPoolCreateInfo queryPoolCI{};
+        queryPoolCI.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolCI.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolCI.queryCount = 2 * maxZones;
+
+        images.resize(imageCount);
+
+        for(auto& image: images)
+            VK_CHECK_RESULT(vkCreateQueryPool(device, &queryPoolCI, nullptr, &image.pool))
+    }
+
+    void GPUProfiler::destroy() {
+        for(auto& image: images)
+            vkDestroyQueryPool(device, image.pool, nullptr);
+
+        images.clear();
+        recording = nullptr;
+        openZones.clear();
+    }
+
+    void GPUProfiler::beginFrame(VkCommandBuffer buffer, uint32_t imageIndex) {
+        recording = nullptr;
+        openZones.clear();
+
+        if(!supported)
+            return;
+
+        auto& image = images.at(imageIndex);
+
+        // command buffer is not in use, so results of its last execution (if any) are ready
+
+        collect(imageIndex);
+
+        image.zones.clear();
+
+        if(!enabled)
+            return;
+
+        vkCmdResetQueryPool(buffer, image.pool, 0, 2 * maxZones);
+
+        recording = &image;
+    }
+
+    void GPUProfiler::endFrame() {
+        assert(openZones.empty() && "Every GPU profiler zone must be closed within the frame");
+        recording = nullptr;
+    }
+
+    void GPUProfiler::beginZone(VkCommandBuffer buffer, std::string const& name) {
+        if(!recording)
+            return;
+
+        // UINT32_MAX marks skipped zone, so endZone stays balanced
+
+        if(recording->zones.size() == maxZones){
+            openZones.push_back(UINT32_MAX);
+            return;
+        }
+
+        uint32_t query = 2 * recording->zones.size();
+
+        recording->zones.push_back({name, static_cast<uint32_t>(openZones.size()), query});
+        openZones.push_back(query);
+
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, recording->pool, query);
+    }
+
+    void GPUProfiler::endZone(VkCommandBuffer buffer) {
+        if(!recording)
+            return;
+
+        assert(!openZones.empty() && "No GPU profiler zone to close");
+
+        uint32_t query = openZones.back();
+        openZones.pop_back();
+
+        if(query == UINT32_MAX)
+            return;
+
+        vkCmdWriteTimestamp(buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, recording->pool, query + 1);
+    }
+
+    void GPUProfiler::submitted(uint32_t imageIndex, uint64_t frame) {
+        if(!supported)
+            return;
+
+        auto& image = images.at(imageIndex);
+
+        image.pending = !image.zones.empty();
+        image.frame = frame;
+    }
+
+    void GPUProfiler::collect(uint32_t imageIndex) {
+        if(!supported)
+            return;
+
+        auto& image = images.at(imageIndex);
+
+        if(!image.pending)
+            return;
+
+        image.pending = false;
+
+        uint32_t queryCount = 2 * image.zones.size();
+        std::vector<uint64_t> timestamps(queryCount);
+
+        // no wait flag: if results are somehow not available, frame is dropped rather than waited for
+
+        VkResult result = vkGetQueryPoolResults(device, image.pool, 0, queryCount, timestamps.size() * sizeof(uint64_t),
+                                                timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if(result == VK_NOT_READY)
+            return;
+
+        VK_CHECK_RESULT(result);
+
+        auto toMs = [this](uint64_t ticks){ return static_cast<double>(ticks) * timestampPeriod / 1000000.0;};
+
+        uint64_t frameBegin = timestamps.front() & timestampMask;
+
+        if(!firstTimestampSet){
+            firstTimestamp = frameBegin;
+            firstTimestampSet = true;
+        }
+
+        FrameTiming frame{};
+        frame.frame = image.frame;
+        frame.start = toMs((frameBegin - firstTimestamp) & timestampMask);
+        frame.zones.reserve(image.zones.size());
+
+        for(auto const& zone: image.zones){
+            uint64_t begin = timestamps.at(zone.query) & timestampMask;
+            uint64_t end = timestamps.at(zone.query + 1) & timestampMask;
+
+            frame.zones.push_back({zone.name, zone.depth,
+                                   toMs((begin - frameBegin) & timestampMask),
+                                   toMs((end - begin) & timestampMask)});
+        }
+
+        history.push_back(std::move(frame));
+
+        while(history.size() > historySize)
+            history.pop_front();
+    }
+
+    bool GPUProfiler::exportTrace(std::string const& filename) const {
+        std::ofstream os(filename, std::ios::out | std::ios::trunc);
+
+        if(!os.is_open()){
+            errs("GPU profiler: could not open trace file " + filename);
+            return false;
+        }
+
+        // complete ("X") events with microsecond timestamps
+
+        os << std::fixed;
+        os.precision(3);
+
+        os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+        os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GPU graphics queue\"}}";
+
+        for(auto const& frame: history)
+            for(auto const& zone: frame.zones){
+                os << ",{\"name\":\"" << Utilities::escapeJSON(zone.name) << "\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":1,\"tid\":1"
+                   << ",\"ts\":" << (frame.start + zone.start) * 1000.0
+                   << ",\"dur\":" << zone.duration * 1000.0
+                   << ",\"args\":{\"frame\":" << frame.frame << "}}";
+            }
+
+        os << "]}";
+
+        logger("GPU profiler: trace of " + std::to_string(history.size()) + " frames written to " + filename);
+
+        return os.good();
+    }
+}
@@ -0,0 +1,108 @@
+//
+// Created by Бушев Дмитрий on 04.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINEGPUPROFILER_H
+#define TEST_EXE_VULGINEGPUPROFILER_H
+
+#include "vulkan/vulkan.h"
+#include <vector>
+#include <deque>
+#include <string>
+
+namespace Vulgine{
+
+    /**
+     * Measures GPU execution time of command buffer regions with timestamp queries.
+     *
+     * Each swap chain image has its own query pool, written by its command buffer. Results are
+     * read once the fence of the image is waited anyway, so reading never stalls CPU. Zones are
+     * stored along with the recorded command buffer, so reused command buffers keep being measured.
+     *
+     * Zones may be nested. Zone opened in secondary command buffer must be closed in it as well.
+     * */
+
+    class GPUProfiler{
+    public:
+        struct ZoneTiming{
+            std::string name;
+            uint32_t depth;
+            double start;       // milliseconds since beginning of the frame
+            double duration;    // milliseconds
+        };
+
+        struct FrameTiming{
+            uint64_t frame;
+            double start;       // milliseconds since first timestamp profiler received
+            std::vector<ZoneTiming> zones;
+        };
+
+    private:
+        struct Zone{
+            std::string name;
+            uint32_t depth;
+            uint32_t query;     // begin timestamp query, end one follows it
+        };
+
+        struct ImageQueries{
+            VkQueryPool pool = VK_NULL_HANDLE;
+            std::vector<Zone> zones;
+            bool pending = false;
+            uint64_t frame = 0;
+        };
+
+        std::vector<ImageQueries> images;
+
+        // recording state, command buffers are recorded one at a time by main thread
+
+        ImageQueries* recording = nullptr;
+        std::vector<uint32_t> openZones;
+
+        VkDevice device = VK_NULL_HANDLE;
+        double timestampPeriod = 1.0;  // nanoseconds per tick
+        uint64_t timestampMask = ~0ull;
+        bool supported = false;
+
+        uint64_t firstTimestamp = 0;
+        bool firstTimestampSet = false;
+
+        std::deque<FrameTiming> history;
+
+    public:
+
+        // zones beyond this count per frame are silently skipped
+
+        static constexpr const uint32_t maxZones = 64;
+
+        // frames kept for trace export
+
+        static constexpr const uint32_t historySize = 256;
+
+        bool enabled = true;
+
+        void create(VkPhysicalDevice physicalDevice, VkDevice logicalDevice, uint32_t queueFamily, uint32_t imageCount);
+        void destroy();
+
+        bool active() const { return enabled && supported;};
+
+        /** resets queries of given image. Must be recorded outside of render pass, before any zone */
+        void beginFrame(VkCommandBuffer buffer, uint32_t imageIndex);
+        void endFrame();
+
+        void beginZone(VkCommandBuffer buffer, std::string const& name);
+        void endZone(VkCommandBuffer buffer);
+
+        /** must be called right after command buffer of the image is submitted */
+        void submitted(uint32_t imageIndex, uint64_t frame);
+
+        /** reads results of last submission of the image. GPU must be done with it */
+        void collect(uint32_t imageIndex);
+
+        FrameTiming const* lastFrame() const { return history.empty() ? nullptr : &history.back();};
+
+        /** writes collected history as Chrome trace event JSON (chrome://tracing, Perfetto) */
+        bool exportTrace(std::string const& filename) const;
+    };
+
+}
+#endif //TEST_EXE_VULGINEGPUPROFILER_H
@@ -51,11 +51,6 @@ bool Vulgine::StaticImageImpl::load(const unsigned char *data, uint32_t len, Ima
 bool Vulgine::StaticImageImpl::loadFromPixelData(const unsigned char *pixels, int texWidth, int texHeight, Image::FileFormat fileFormat) {
     uint32_t imageSize = texWidth * texHeight * 4;
 
-    Memory::StagingBuffer stagingBuffer;
-
-    stagingBuffer.create(imageSize);
-    stagingBuffer.fill(pixels);
-
 
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -69,18 +64,18 @@ bool Vulgine::StaticImageImpl::loadFromPixelData(const unsigned char *pixels, in
     imageInfo.format = VK_FORMAT_R8G8B8A8_SRGB;
     imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
     imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    // image is a copy source when defragmentation moves it
+
+    imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.flags = 0; // Optional
 
     image.allocate(imageInfo, VMA_MEMORY_USAGE_GPU_ONLY, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    image.transitImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    // pixels are copied to staging memory right away, image is filled by the next upload batch
 
-    image.copyFromBuffer(stagingBuffer.buffer, texWidth, texHeight);
-
-    image.transitImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    GetImpl().uploader.upload(image, pixels, imageSize);
 
     GetImpl().gui.addTexturedImage(&image);
     return true;
@@ -105,6 +100,12 @@ void Vulgine::DynamicImageImpl::createImpl() {
     images.reserve(imageCount);
     for(int i = 0; i < imageCount; ++i){
         auto& image = images.emplace_back();
+
+        if(transient){
+            image.create(createInfo);
+            continue;
+        }
+
         VmaMemoryUsage memUsage = VMA_MEMORY_USAGE_GPU_ONLY;
         uint32_t reqs = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 
@@ -115,5 +116,6 @@ void Vulgine::DynamicImageImpl::createImpl() {
 
 void Vulgine::DynamicImageImpl::destroyImpl() {
     images.clear();
+    heaps.clear();
 }
 
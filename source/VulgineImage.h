@@ -26,10 +26,22 @@ namespace Vulgine{
         void destroyImpl() override;
     };
 
+    struct TransientHeap;
+
     struct DynamicImageImpl: public Image, public ObjectImplNoMove{
+
+        // memory of transient images, kept alive while they are. Declared before images, so it is destroyed after them
+
+        std::vector<std::shared_ptr<TransientHeap>> heaps;
+
         std::vector<Memory::Image> images;
         VkImageCreateInfo createInfo{};
 
+        // transient images have no memory of their own: render graph binds them to memory shared with
+        // transient attachments of other render passes, see RenderGraph::allocateTransients()
+
+        bool transient = false;
+
         explicit DynamicImageImpl(uint32_t id): ObjectImplNoMove(Type::IMAGE, id){}
 
         // TODO: I should reconsider following functions being part of Image general interface because for dynamic images they make no sense
@@ -5,6 +5,7 @@
 #include "VulgineObjects.h"
 #include "Vulgine.h"
 #include "Utilities.h"
+#include <algorithm>
 
 
 namespace Vulgine{
@@ -12,13 +13,13 @@ namespace Vulgine{
     std::unordered_map<Object::Type, uint32_t> ObjectImpl::countMap{};
     std::unordered_map<Object::Type, std::string> ObjectImpl::typeNames{};
 
-    std::stack<uint32_t> ObjectImpl::freeIds{};
+    std::vector<ObjectImpl::Slot> ObjectImpl::slots{};
+    std::vector<uint32_t> ObjectImpl::freeSlots{};
     uint32_t ObjectImpl::claimedIdsCount = 0;
-    std::unordered_map<uint32_t, ObjectImpl*> ObjectImpl::objMap{};
 
     ObjectImpl::ObjectImpl(Type typeId, uint32_t id): typeId_(typeId), id_(id){
 
-        objMap.emplace(id_, this);
+        slots.at(slotIndex(id_)).object = this;
 
         logger(typeNames.at(typeId_) + " #" + std::to_string(id_) + " created");
         if(countMap.count(typeId))
@@ -74,28 +75,44 @@ uint32_t ObjectImpl::count(Type type) { return countMap.count(type) ? countMap.a
 
     uint32_t ObjectImpl::claimId() {
         claimedIdsCount++;
-        if(freeIds.empty()){
-            return claimedIdsCount - 1;
+
+        uint32_t index;
+
+        if(freeSlots.empty()){
+            index = slots.size();
+
+            // the last index is left out, so no id equals UINT32_MAX used by moved objects
+
+            if(index == indexMask)
+                Utilities::ExitFatal(-1, "Too many objects alive");
+
+            slots.emplace_back();
         } else{
-            auto ret = freeIds.top();
-            freeIds.pop();
-            return ret;
+            index = freeSlots.back();
+            freeSlots.pop_back();
         }
+
+        return (slots.at(index).generation << indexBits) | index;
     }
 
     void ObjectImpl::invalidateId(uint32_t id) {
-        freeIds.push(id);
-        objMap.erase(id);
+        auto index = slotIndex(id);
+        auto& slot = slots.at(index);
+
+        slot.object = nullptr;
+        slot.generation = (slot.generation + 1) & (UINT32_MAX >> indexBits);
+
+        freeSlots.push_back(index);
         claimedIdsCount--;
     }
 
     ObjectImpl *ObjectImpl::get(uint32_t id) {
-        auto it = objMap.find(id);
+        auto index = slotIndex(id);
 
-        if(it != objMap.end())
-            return it->second;
-        else
+        if(index >= slots.size() || slots[index].generation != id >> indexBits)
             return nullptr;
+
+        return slots[index].object;
     }
 
     ObjectImpl &ObjectImpl::operator=(ObjectImpl &&another) noexcept{
@@ -104,7 +121,7 @@ uint32_t ObjectImpl::count(Type type) { return countMap.count(type) ? countMap.a
         name = another.name;
         created = another.created;
 
-        objMap.at(id_) = this;
+        slots.at(slotIndex(id_)).object = this;
         another.id_ = UINT32_MAX;
         another.created = false;
 
@@ -114,14 +131,17 @@ uint32_t ObjectImpl::count(Type type) { return countMap.count(type) ? countMap.a
     ObjectImpl::ObjectImpl(ObjectImpl &&another) noexcept: id_(another.id_), name(another.name),
     typeId_(another.typeId_){
         created = another.created;
-        objMap.at(id_) = this;
+        slots.at(slotIndex(id_)).object = this;
         another.id_ = UINT32_MAX;
         another.created = false;
     }
 
     void ObjectImpl::for_each(std::function<void(ObjectImpl*)> const& action) {
-        for(auto const& it: objMap)
-            action(it.second);
+        // action may create objects, which reallocates the table
+
+        for(size_t i = 0; i < slots.size(); ++i)
+            if(auto* object = slots[i].object)
+                action(object);
     }
 
     Object* Object::get(uint32_t id){
@@ -157,6 +177,19 @@ uint32_t ObjectImpl::count(Type type) { return countMap.count(type) ? countMap.a
                 ") by having" + std::to_string(vertexInputAttachments) + " of them");
                 return false;
             }
+
+            // every uniform buffer is bound as dynamic one
+
+            auto maxUniformBuffersDynamic = GetImpl().device->properties.limits.maxDescriptorSetUniformBuffersDynamic;
+            uint32_t uniformBuffers = std::count_if(geometry->descriptors.begin(), geometry->descriptors.end(), [](DescriptorInfo const& descriptor){
+                return descriptor.type == DescriptorInfo::Type::UNIFORM_BUFFER;
+            });
+
+            if(uniformBuffers > maxUniformBuffersDynamic){
+                errs(geometry->objectLabel() + " exceeds device.limits.maxDescriptorSetUniformBuffersDynamic(" + std::to_string(maxUniformBuffersDynamic) +
+                ") by having " + std::to_string(uniformBuffers) + " of them");
+                return false;
+            }
         }
 
         return true;
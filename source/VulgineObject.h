@@ -6,8 +6,9 @@
 #define TEST_EXE_VULGINEOBJECT_H
 
 #include "IVulgineObjects.h"
-#include <stack>
 #include <functional>
+#include <vector>
+#include "VulgineCPUProfiler.h"
 
 #define SELF_CHECK_DEVICE_LIMITS() assert(checkDeviceLimits(this) && "object exceeds device limits");
 
@@ -20,9 +21,17 @@ namespace Vulgine{
     class ObjectImpl: public virtual Object{
     private:
 
-        static std::stack<uint32_t> freeIds;
+        // Ids are generational handles: low bits index slot of object table, high bits tell how many times
+        // the slot was reused. Stale id of destroyed object doesn't match generation of its slot anymore.
+
+        struct Slot{
+            ObjectImpl* object = nullptr;
+            uint32_t generation = 0;
+        };
+
+        static std::vector<Slot> slots;
+        static std::vector<uint32_t> freeSlots;
         static uint32_t claimedIdsCount;
-        static std::unordered_map<uint32_t, ObjectImpl*> objMap;
 
         static std::unordered_map<Type, uint32_t> countMap;          // TODO: make this full-static map (constexpr)
         static std::unordered_map<Type, std::string> typeNames;      // TODO: make this full static map (constexpr)
@@ -40,6 +49,12 @@ namespace Vulgine{
         std::optional<std::string> name;
     public:
 
+        static constexpr const uint32_t indexBits = 20;
+        static constexpr const uint32_t indexMask = (1u << indexBits) - 1;
+
+        /** slot of object table id refers to. Slots are dense, so they may index per-object arrays */
+        static uint32_t slotIndex(uint32_t id) { return id & indexMask;};
+
         static uint32_t claimId();
 
         explicit ObjectImpl(Type typeId, uint32_t id);
@@ -49,6 +64,7 @@ namespace Vulgine{
         void create() final {
             if(created)
                 return;
+            VULGINE_PROFILE_ZONE("Object::create");
             SELF_CHECK_DEVICE_LIMITS();
             createImpl();
             created = true;
@@ -7,6 +7,7 @@
 #include "Vulgine.h"
 #include "VulgineImage.h"
 #include "vulkan/VulkanInitializers.hpp"
+#include <algorithm>
 
 namespace Vulgine{
 
@@ -57,57 +58,24 @@ namespace Vulgine{
 
         SELF_CHECK_DEVICE_LIMITS()
 
-        cachedInstances.pData = instances.pData;
-        cachedInstances.count = instances.count;
-
-        cachedVertices.pData = vertices.pData;
-        cachedVertices.count = vertices.count;
-
-        int framebufferCount = GetImpl().settings.framesInFlight;
-
-        if(vertices.dynamic){
-
-            for(int i = 0; i < framebufferCount; ++i) {
-                auto* dynamicBuf = new Memory::DynamicVertexBuffer{};
-                dynamicBuf->create(vertices.count * geometry->vertexFormat.perVertexSize());
-                dynamicBuf->binding = 0;
-                perVertex.emplace_back(dynamicBuf, false);
-            }
-
-        }
-        else{
-            auto* staticBuf = new Memory::StaticVertexBuffer{};
-            staticBuf->create(vertices.pData, vertices.count * geometry->vertexFormat.perVertexSize());
-            staticBuf->binding = 0;
-            perVertex.emplace_back(staticBuf, false);
-        }
-
-
+        if(vertices.dynamic)
+            createDynamicData(perVertex, vertices.count * geometry->vertexFormat.perVertexSize(), 0);
+        else
+            uploadVertices();
 
         // Vulgine allows rendering unindexed meshes
 
         if(!indices.empty())
-            indexBuffer.create(indices.data(), indices.size());
+            uploadIndices();
 
 
         // we will use instance buffer if we actually have multiple instances
 
         if(instances.count > 0) {
-            if (instances.dynamic) {
-
-                for(int i = 0; i < framebufferCount; ++i) {
-                    auto *dynamicBuf = new Memory::DynamicVertexBuffer{};
-                    dynamicBuf->create(instances.count * geometry->vertexFormat.perInstanceSize());
-                    dynamicBuf->binding = 1;
-                    perInstance.emplace_back(dynamicBuf, false);
-                }
-
-            } else {
-                auto *staticBuf = new Memory::StaticVertexBuffer{};
-                staticBuf->create(instances.pData, instances.count * geometry->vertexFormat.perInstanceSize());
-                staticBuf->binding = 1;
-                perInstance.emplace_back(staticBuf, false);
-            }
+            if (instances.dynamic)
+                createDynamicData(perInstance, instances.count * geometry->vertexFormat.perInstanceSize(), 1);
+            else
+                uploadInstances();
 
         }
 
@@ -148,10 +116,10 @@ namespace Vulgine{
     }
 
     void MeshImpl::destroyImpl() {
-        for(auto buf: perVertex)
-            delete buf.first;
-        for(auto buf: perInstance)
-            delete buf.first;
+        for(auto& dynamicData: perVertex)
+            delete dynamicData.buffer;
+        for(auto& dynamicData: perInstance)
+            delete dynamicData.buffer;
         if(set) {
             set->freeSets();
             set.value().destroy();
@@ -160,157 +128,408 @@ namespace Vulgine{
         perVertex.clear();
         perInstance.clear();
 
-        if(indexBuffer.allocated)
-            indexBuffer.free();
+        releaseVertices();
+        releaseInstances();
+        releaseIndices();
     }
 
-    void MeshImpl::draw(VkCommandBuffer commandBuffer, SceneImpl* scene, CameraImpl *camera, RenderPass *pass, int currentFrame) {
-        int vertBufId = vertices.dynamic ? GetImpl().currentFrame : 0;
-        int instanceBufId = instances.dynamic ? GetImpl().currentFrame : 0;
+    namespace {
+        void releaseRegion(Memory::BufferPool& pool, Memory::BufferRegion& region){
+            if(!region)
+                return;
+
+            GetImpl().retire([&pool, region](){ pool.free(region); });
 
-        auto& vertexBuf = perVertex.at(vertBufId);
-        if(vertexBuf.second) {
-            pushVertexBuffer(vertBufId);
-            vertexBuf.second = false;
+            region = Memory::BufferRegion{};
         }
 
-        vertexBuf.first->bind(commandBuffer);
+        void swapRegion(Memory::BufferPool& pool, Memory::BufferRegion& current, Memory::BufferRegion& pending){
+            if(!pending)
+                return;
 
-        if(instances.count > 0) {
-            auto &instanceBuf = perInstance.at(instanceBufId);
-            if (instanceBuf.second) {
-                pushInstanceBuffer(instanceBufId);
-                instanceBuf.second = false;
+            GetImpl().cancelSwap(&current);
+
+            releaseRegion(pool, current);
+            current = pending;
+            pending = Memory::BufferRegion{};
+        }
+
+        void releaseRegions(Memory::BufferPool& pool, Memory::BufferRegion& current, Memory::BufferRegion& pending){
+            GetImpl().cancelSwap(&current);
+
+            releaseRegion(pool, pending);
+            releaseRegion(pool, current);
+        }
+
+        // Frames keep drawing current region until upload of the new one is done, so they don't wait for
+        // transfer. Region is used at once if there is no current one, GPU orders it after upload anyway
+
+        // FNV-1a
+
+        uint64_t hashBytes(const void* data, size_t size){
+            auto* bytes = static_cast<unsigned char const*>(data);
+            uint64_t hash = 14695981039346656037ull;
+
+            for(size_t i = 0; i < size; ++i){
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
             }
-            if (!perInstance.empty())
-                instanceBuf.first->bind(commandBuffer);
+
+            return hash;
         }
 
+        void replaceRegion(Memory::BufferPool& pool, Memory::BufferRegion& current, Memory::BufferRegion& pending,
+                           Memory::BufferRegion region, UploadToken token){
+            releaseRegion(pool, pending);
 
-        bool hasMeshDescriptors = set.has_value();
+            if(!current){
+                GetImpl().cancelSwap(&current);
+                current = region;
+                return;
+            }
 
+            pending = region;
 
-        uint32_t instCount = instances.count == 0 ? 1 : instances.count;
+            GetImpl().swapWhenUploaded(&current, token, [&pool, &current, &pending](){
+                swapRegion(pool, current, pending);
+            });
+        }
+    }
 
-        if(!indexBuffer.allocated) {
+    void MeshImpl::uploadVertices() {
+        auto stride = geometry->vertexFormat.perVertexSize();
+        auto size = vertices.count * stride;
 
-            auto *material = dynamic_cast<MaterialImpl *>(primitives[0].material.get());
-            auto &boundPipeline = GetImpl().pipelineMap.bind({dynamic_cast<GeometryImpl *>(geometry.get()),
-                                                              dynamic_cast<MaterialImpl *>(primitives[0].material.get()),
-                                                              scene, dynamic_cast<RenderPassImpl *>(pass)},
-                                                             commandBuffer);
+        auto region = GetImpl().vertexPool.allocate(size, stride);
+        auto token = GetImpl().vertexPool.write(region, vertices.pData, size);
 
-            // dynamic_cast<SceneImpl*>(parent())->set.bind(0, commandBuffer, boundPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
+        verticesSource = vertices.pData;
+        verticesHash = hashBytes(vertices.pData, size);
 
-            if (hasMeshDescriptors)
-                set.value().bind(1, commandBuffer, boundPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                 currentFrame);
+        replaceRegion(GetImpl().vertexPool, staticVertices, pendingVertices, region, token);
+    }
 
-            if (material->set.isCreated())
-                material->set.bind(0, commandBuffer, boundPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                   currentFrame);
+    void MeshImpl::uploadInstances() {
+        auto stride = geometry->vertexFormat.perInstanceSize();
+        auto size = instances.count * stride;
 
-            vkCmdPushConstants(commandBuffer, boundPipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                               sizeof(camera->matrices), &(camera->matrices));
-            vkCmdDraw(commandBuffer, vertices.count, instCount, 0, 0);
+        auto region = GetImpl().vertexPool.allocate(size, stride);
+        auto token = GetImpl().vertexPool.write(region, instances.pData, size);
 
-           if(this == highlighted){
+        replaceRegion(GetImpl().vertexPool, staticInstances, pendingInstances, region, token);
+    }
 
-                auto& highlightPipeline = GetImpl().pipelineMap.bind({dynamic_cast<GeometryImpl*>(geometry.get()),
-                                            dynamic_cast<MaterialImpl *>(GetImpl().highlightMaterial.get()),
-                                            scene, dynamic_cast<RenderPassImpl *>(pass)}, commandBuffer);
-                if(hasMeshDescriptors)
-                    set.value().bind(1, commandBuffer, highlightPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-                dynamic_cast<MaterialImpl *>(GetImpl().highlightMaterial.get())->
-                        set.bind(0, commandBuffer, highlightPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-                vkCmdPushConstants(commandBuffer, highlightPipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(camera->matrices), &(camera->matrices));
-                vkCmdDraw(commandBuffer, vertices.count, instCount, 0, 0);
-            }
-        }else{
-            indexBuffer.bind(commandBuffer);
-            for (const auto& primitive: primitives) {
-
-                auto *material = dynamic_cast<MaterialImpl *>(primitive.material.get());
-                auto &boundPipeline = GetImpl().pipelineMap.bind(
-                        {dynamic_cast<GeometryImpl *>(geometry.get()), material,
-                         scene, dynamic_cast<RenderPassImpl *>(pass)}, commandBuffer);
-
-                // dynamic_cast<SceneImpl*>(parent())->set.bind(0, commandBuffer, boundPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-
-                if (hasMeshDescriptors)
-                    set.value().bind(1, commandBuffer, boundPipeline.pipelineLayout,
-                                     VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-
-                if (material->set.isCreated())
-                    material->set.bind(0, commandBuffer, boundPipeline.pipelineLayout,
-                                       VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-
-                vkCmdPushConstants(commandBuffer, boundPipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
-                                   sizeof(camera->matrices), &(camera->matrices));
-                vkCmdDrawIndexed(commandBuffer, primitive.indexCount, instCount, primitive.startIdx, 0, 0);
-
-                if(highlighted == this){
-
-                    auto& highlightPipeline = GetImpl().pipelineMap.bind({dynamic_cast<GeometryImpl*>(geometry.get()),
-                                                dynamic_cast<MaterialImpl *>(GetImpl().highlightMaterial.get()),
-                                                scene, dynamic_cast<RenderPassImpl *>(pass)}, commandBuffer);
-                    if(hasMeshDescriptors)
-                        set.value().bind(1, commandBuffer, highlightPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-                    dynamic_cast<MaterialImpl *>(GetImpl().highlightMaterial.get())->
-                            set.bind(0, commandBuffer, highlightPipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
-                    vkCmdPushConstants(commandBuffer, highlightPipeline.pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(camera->matrices), &(camera->matrices));
-                    vkCmdDrawIndexed(commandBuffer, primitive.indexCount, instCount, primitive.startIdx, 0, 0);
-                }
+    void MeshImpl::uploadIndices() {
+        auto size = indices.size() * sizeof(uint32_t);
+
+        staticIndices = GetImpl().indexPool.allocate(size, sizeof(uint32_t));
+        GetImpl().indexPool.write(staticIndices, indices.data(), size);
+
+        indicesHash = hashBytes(indices.data(), size);
+    }
+
+    void MeshImpl::releaseVertices() {
+        releaseRegions(GetImpl().vertexPool, staticVertices, pendingVertices);
+    }
+
+    void MeshImpl::releaseInstances() {
+        releaseRegions(GetImpl().vertexPool, staticInstances, pendingInstances);
+    }
+
+    void MeshImpl::releaseIndices() {
+        releaseRegion(GetImpl().indexPool, staticIndices);
+    }
+
+    bool CommandState::change(bool changed) {
+        if(changed)
+            binds++;
+        else
+            elidedBinds++;
+
+        return changed;
+    }
+
+    void CommandState::bindPipeline(VkCommandBuffer commandBuffer, GeneralPipeline const* newPipeline) {
+        if(!change(pipeline != newPipeline->pipeline))
+            return;
+
+        newPipeline->bind(commandBuffer);
+        pipeline = newPipeline->pipeline;
+
+        // sets and push constants stay bound only for the layout they were bound with
+
+        if(layout != newPipeline->pipelineLayout){
+            layout = newPipeline->pipelineLayout;
+            sets.fill(nullptr);
+            pushedData = nullptr;
+        }
+    }
+
+    void CommandState::bindSet(VkCommandBuffer commandBuffer, uint32_t set, DescriptorSet &descriptorSet, int currentFrame) {
+        assert(set < maxSets && "Descriptor set number isn't tracked");
+
+        if(!change(sets.at(set) != &descriptorSet))
+            return;
+
+        descriptorSet.bind(set, commandBuffer, layout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
+        sets.at(set) = &descriptorSet;
+    }
+
+    void CommandState::pushConstants(VkCommandBuffer commandBuffer, VkShaderStageFlags stages, const void *data, uint32_t size) {
+        if(!change(pushedData != data))
+            return;
+
+        vkCmdPushConstants(commandBuffer, layout, stages, 0, size, data);
+        pushedData = data;
+    }
+
+    void CommandState::bindVertices(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+        if(!change(vertices != buffer))
+            return;
+
+        const VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 0, 1, &buffer, &offset);
+        vertices = buffer;
+    }
+
+    void CommandState::bindInstances(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+        if(!change(instances != buffer))
+            return;
+
+        const VkDeviceSize offset = 0;
+        vkCmdBindVertexBuffers(commandBuffer, 1, 1, &buffer, &offset);
+        instances = buffer;
+    }
+
+    void CommandState::bindIndices(VkCommandBuffer commandBuffer, VkBuffer buffer) {
+        if(!change(indices != buffer))
+            return;
+
+        vkCmdBindIndexBuffer(commandBuffer, buffer, 0, VK_INDEX_TYPE_UINT32);
+        indices = buffer;
+    }
+
+    void MeshImpl::compileDrawPackets(SceneImpl *scene, RenderPassImpl *pass, std::vector<DrawPacket> &packets) {
+        auto& vlg = GetImpl();
+        auto* geometryImpl = dynamic_cast<GeometryImpl*>(geometry.get());
+
+        DrawPacket packet{};
+
+        packet.meshSet = set.has_value() ? &set.value() : nullptr;
+
+        if(vertices.dynamic || (instances.dynamic && instances.count > 0))
+            packet.dynamicMesh = this;
+
+        // static data being drawn may be older than mesh data until its replacement is swapped in
+
+        packet.count = vertices.count;
+        packet.instanceCount = instances.count == 0 ? 1 : instances.count;
+
+        if(!vertices.dynamic) {
+            packet.vertices = staticVertices.buffer;
+            packet.firstVertex = staticVertices.offset / geometry->vertexFormat.perVertexSize();
+            packet.count = staticVertices.size / geometry->vertexFormat.perVertexSize();
+        }
+
+        if(instances.count > 0 && !instances.dynamic) {
+            packet.instances = staticInstances.buffer;
+            packet.firstInstance = staticInstances.offset / geometry->vertexFormat.perInstanceSize();
+            packet.instanceCount = staticInstances.size / geometry->vertexFormat.perInstanceSize();
+        }
+
+        auto* highlightMaterial = this == highlighted ? dynamic_cast<MaterialImpl*>(vlg.highlightMaterial.get()) : nullptr;
+
+        // pipelines that are still being compiled are skipped. Packets are compiled again once they are ready
+
+        auto add = [&](MaterialImpl* material, DrawPacket const& draw){
+            auto* pipeline = vlg.pipelineMap.get({geometryImpl, material, scene, pass});
+            if(!pipeline)
+                return;
+
+            auto& added = packets.emplace_back(draw);
+            added.pipeline = pipeline;
+            added.materialSet = material->set.isCreated() ? &material->set : nullptr;
+            added.overlay = material == highlightMaterial;
+        };
+
+        if(!staticIndices) {
+            add(dynamic_cast<MaterialImpl*>(primitives[0].material.get()), packet);
+
+            if(highlightMaterial)
+                add(highlightMaterial, packet);
+        } else {
+            packet.indices = staticIndices.buffer;
+
+            auto firstIndex = staticIndices.offset / sizeof(uint32_t);
+
+            for(const auto& primitive: primitives) {
+                DrawPacket primitivePacket = packet;
+                primitivePacket.count = primitive.indexCount;
+                primitivePacket.firstIndex = firstIndex + primitive.startIdx;
+
+                add(dynamic_cast<MaterialImpl*>(primitive.material.get()), primitivePacket);
+
+                if(highlightMaterial)
+                    add(highlightMaterial, primitivePacket);
             }
         }
+    }
+
+    void MeshImpl::pushDynamicData() {
+        int frame = GetImpl().currentFrame;
+
+        GetImpl().frameDependentCommands = true;
+
+        if(vertices.dynamic)
+            pushVertexBuffer(frame);
+
+        if(instances.dynamic && instances.count > 0) {
+
+            // mesh created without instances has no buffers yet, they are created once it gets some
+
+            if(perInstance.empty())
+                createDynamicData(perInstance, instances.count * geometry->vertexFormat.perInstanceSize(), 1);
+
+            pushInstanceBuffer(frame);
+        }
+    }
+
+    void MeshImpl::bindDynamicData(VkCommandBuffer commandBuffer, CommandState &state) {
+        int frame = GetImpl().currentFrame;
+
+        if(vertices.dynamic)
+            state.bindVertices(commandBuffer, perVertex.at(frame).buffer->buffer);
+
+        if(instances.dynamic && instances.count > 0)
+            state.bindInstances(commandBuffer, perInstance.at(frame).buffer->buffer);
+    }
+
+    bool DrawPacket::sharesState(DrawPacket const& other) const {
+        return indices && !dynamicMesh && !other.dynamicMesh && pipeline == other.pipeline &&
+               materialSet == other.materialSet && meshSet == other.meshSet && vertices == other.vertices &&
+               instances == other.instances && indices == other.indices;
+    }
+
+    void DrawPacket::record(VkCommandBuffer commandBuffer, CameraImpl const* camera, int currentFrame, CommandState &state, uint32_t drawCount) const {
+        if(dynamicMesh)
+            dynamicMesh->bindDynamicData(commandBuffer, state);
+
+        if(vertices)
+            state.bindVertices(commandBuffer, vertices);
+        if(instances)
+            state.bindInstances(commandBuffer, instances);
+        if(indices)
+            state.bindIndices(commandBuffer, indices);
+
+        state.bindPipeline(commandBuffer, pipeline);
+
+        if(meshSet)
+            state.bindSet(commandBuffer, 1, *meshSet, currentFrame);
+
+        if(materialSet)
+            state.bindSet(commandBuffer, 0, *materialSet, currentFrame);
+
+        state.pushConstants(commandBuffer, VK_SHADER_STAGE_VERTEX_BIT, &(camera->matrices), sizeof(camera->matrices));
+
+        if(drawCount > 1){
+            assert(indirect && "Only packets of indirect run may be drawn together");
+
+            auto drawIndirectCount = GetImpl().fpCmdDrawIndexedIndirectCount;
+
+            // count in buffer is the one of the whole run, so range recording part of it is limited by max count
+
+            if(drawIndirectCount)
+                drawIndirectCount(commandBuffer, indirect, indirectOffset, indirect, countOffset, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+            else
+                vkCmdDrawIndexedIndirect(commandBuffer, indirect, indirectOffset, drawCount, sizeof(VkDrawIndexedIndirectCommand));
+
+            return;
+        }
+
+        // Counts of dynamic data may be changed by range updates, which don't make packets compiled again.
+        // Its buffers are pushed for the current counts before recording
+
+        uint32_t vertexCount = count;
+        uint32_t drawnInstances = instanceCount;
+
+        if(dynamicMesh){
+            if(dynamicMesh->vertices.dynamic && !indices)
+                vertexCount = dynamicMesh->vertices.count;
+            if(dynamicMesh->instances.dynamic && dynamicMesh->instances.count > 0)
+                drawnInstances = dynamicMesh->instances.count;
+        }
 
+        if(indices)
+            vkCmdDrawIndexed(commandBuffer, count, drawnInstances, firstIndex, firstVertex, firstInstance);
+        else
+            vkCmdDraw(commandBuffer, vertexCount, drawnInstances, firstVertex, firstInstance);
     }
 
     MeshImpl::~MeshImpl() {
         if(isCreated()) {
-            for (auto buf: perVertex)
-                delete buf.first;
-            for (auto buf: perInstance)
-                delete buf.first;
+            for (auto& dynamicData: perVertex)
+                delete dynamicData.buffer;
+            for (auto& dynamicData: perInstance)
+                delete dynamicData.buffer;
             if(set) {
                 set->freeSets();
                 set.value().destroy();
             }
+
+            // mesh is destroyed after it was retired, so GPU doesn't use its data anymore
+
+            GetImpl().cancelSwap(&staticVertices);
+            GetImpl().cancelSwap(&staticInstances);
+
+            GetImpl().vertexPool.free(staticVertices);
+            GetImpl().vertexPool.free(pendingVertices);
+            GetImpl().vertexPool.free(staticInstances);
+            GetImpl().vertexPool.free(pendingInstances);
+            GetImpl().indexPool.free(staticIndices);
         }
     }
 
     void MeshImpl::updateVertexBuffer() {
         if(vertices.dynamic){
-            for(auto& buf: perVertex)
-                buf.second = true;
+            for(auto& dynamicData: perVertex)
+                dynamicData.dirty.markAll();
         }
         else{
-            vkQueueWaitIdle(GetImpl().queue);
-            perVertex.at(0).first->free();
-            auto* statVert = dynamic_cast<Memory::StaticVertexBuffer*>(perVertex.at(0).first);
-            statVert->create(vertices.pData, vertices.count * geometry->vertexFormat.perVertexSize());
+            // frames in flight may still read old region, so it's replaced instead of being rewritten
+
+            uploadVertices();
         }
 
         GetImpl().cmdBuffersOutdated = true;
     }
 
     void MeshImpl::updateIndexBuffer() {
-        indexBuffer.free();
-        indexBuffer.create(indices.data(), indices.size());
+        // New indices are drawn at once along with new primitives, so vertex data they refer to must be
+        // swapped in too. GPU waits for the upload then
+
+        swapRegion(GetImpl().vertexPool, staticVertices, pendingVertices);
+        swapRegion(GetImpl().vertexPool, staticInstances, pendingInstances);
+
+        releaseIndices();
+
+        if(!indices.empty())
+            uploadIndices();
 
         GetImpl().cmdBuffersOutdated = true;
     }
 
     void MeshImpl::updateInstanceBuffer() {
         if(instances.dynamic){
-            for(auto& buf: perInstance)
-                buf.second = true;
+            for(auto& dynamicData: perInstance)
+                dynamicData.dirty.markAll();
         }
         else{
-            vkQueueWaitIdle(GetImpl().queue);
-            perInstance.at(0).first->free();
-            auto* statVert = dynamic_cast<Memory::StaticVertexBuffer*>(perInstance.at(0).first);
-            statVert->create(instances.pData, instances.count * geometry->vertexFormat.perInstanceSize());
+            // frames in flight may still read old region, so it's replaced instead of being rewritten
+
+            if(instances.count > 0)
+                uploadInstances();
+            else
+                releaseInstances();
         }
 
         GetImpl().cmdBuffersOutdated = true;
@@ -509,29 +728,99 @@ namespace Vulgine{
     }
 
     void MeshImpl::pushVertexBuffer(int id) {
-        auto* dynVert = dynamic_cast<Memory::DynamicVertexBuffer*>(perVertex.at(id).first);
-        if(cachedVertices.pData != vertices.pData || cachedVertices.count != vertices.count) {
-            dynVert->free();
-            dynVert->create(vertices.count * geometry->vertexFormat.perVertexSize());
-            cachedVertices.pData = vertices.pData;
-            cachedVertices.count = vertices.count;
-        } else{
-            dynVert->push(vertices.pData);
+        push(perVertex.at(id), vertices.pData, vertices.count * geometry->vertexFormat.perVertexSize());
+    }
+
+    void MeshImpl::pushInstanceBuffer(int id) {
+        push(perInstance.at(id), instances.pData, instances.count * geometry->vertexFormat.perInstanceSize());
+    }
+
+    void MeshImpl::createDynamicData(std::vector<DynamicData>& data, size_t size, uint32_t binding) {
+        for(int i = 0; i < GetImpl().settings.framesInFlight; ++i) {
+            auto& dynamicData = data.emplace_back();
+            dynamicData.buffer = new Memory::DynamicVertexBuffer{};
+            dynamicData.buffer->create(size);
+            dynamicData.buffer->binding = binding;
+            dynamicData.dirty.markAll();
+        }
+    }
+
+    void MeshImpl::push(DynamicData& dynamicData, void* pData, size_t size) {
+        auto* buffer = dynamicData.buffer;
+
+        // Buffer of this frame was last read by frame the current one has waited for, so it may be
+        // recreated right away. Spare capacity lets count grow without reallocation every time
+
+        if(size > buffer->capacity()){
+            buffer->create(std::max(size, buffer->capacity() * 2));
+            dynamicData.dirty.markAll();
+        }
+
+        if(dynamicData.dirty.empty() || size == 0)
             return;
+
+        if(dynamicData.dirty.whole())
+            buffer->push(pData, size, 0);
+        else
+            for(auto const& range: dynamicData.dirty.list()){
+                if(range.first >= size)
+                    break;
+
+                auto end = std::min(range.second, size);
+                buffer->push(static_cast<char*>(pData) + range.first, end - range.first, range.first);
+            }
+
+        dynamicData.dirty.clear();
+    }
+
+    void DirtyRanges::mark(size_t begin, size_t end) {
+        if(all || begin >= end)
+            return;
+
+        ranges.emplace_back(begin, end);
+
+        std::sort(ranges.begin(), ranges.end());
+
+        // merge overlapping and adjacent ranges
+
+        size_t merged = 0;
+        for(size_t i = 1; i < ranges.size(); ++i){
+            if(ranges.at(i).first <= ranges.at(merged).second)
+                ranges.at(merged).second = std::max(ranges.at(merged).second, ranges.at(i).second);
+            else
+                ranges.at(++merged) = ranges.at(i);
         }
+        ranges.resize(merged + 1);
+
+        if(ranges.size() > maxRanges)
+            markAll();
     }
 
-    void MeshImpl::pushInstanceBuffer(int id) {
-        auto* dynVert = dynamic_cast<Memory::DynamicVertexBuffer*>(perInstance.at(id).first);
-        if(cachedInstances.pData != instances.pData || cachedInstances.count != instances.count) {
-            dynVert->free();
-            dynVert->create(instances.count * geometry->vertexFormat.perInstanceSize());
-            cachedInstances.pData = instances.pData;
-            cachedInstances.count = instances.count;
-        } else{
-            dynVert->push(instances.pData);
+    void MeshImpl::updateVertexRange(uint32_t first, uint32_t count) {
+        if(!vertices.dynamic){
+            updateVertexBuffer();
+            return;
+        }
+
+        auto stride = geometry->vertexFormat.perVertexSize();
+
+        for(auto& dynamicData: perVertex)
+            dynamicData.dirty.mark(first * stride, (first + count) * stride);
+    }
+
+    void MeshImpl::updateInstanceRange(uint32_t first, uint32_t count) {
+
+        // mesh without instances is drawn without instance buffer, so its packets must be compiled again
+
+        if(!instances.dynamic || perInstance.empty() || instances.count == 0){
+            updateInstanceBuffer();
             return;
         }
+
+        auto stride = geometry->vertexFormat.perInstanceSize();
+
+        for(auto& dynamicData: perInstance)
+            dynamicData.dirty.mark(first * stride, (first + count) * stride);
     }
 
     MaterialImpl::~MaterialImpl() {
@@ -596,44 +885,109 @@ namespace Vulgine{
 
     void UniformBufferImpl::createImpl() {
         if(dynamic){
-            int imageCount = GetImpl().swapChain.imageCount;
-            for(int i = 0; i < imageCount; i++) {
-                auto *dynBuffer = new Memory::DynamicBuffer{};
-                dynBuffer->create(size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-                buffers.emplace_back(dynBuffer);
-            }
+            auto& vlg = GetImpl();
+            auto capacity = vlg.uniformRing.capacity();
+
+            slot = vlg.uniformRing.allocate(size);
+            slotted = true;
+
+            // grown ring has new buffer and sections, so every image must rebind it
+
+            if(vlg.uniformRing.capacity() != capacity)
+                for(auto& state: vlg.cmdBuffersState){
+                    state.outdated = true;
+                    state.descriptorsOutdated = true;
+                }
+
+            updated.resize(vlg.swapChain.imageCount, false);
         } else{
             auto* staticBuffer = new Memory::ImmutableBuffer{};
             staticBuffer->create(pData, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
             buffers.emplace_back(staticBuffer);
         }
-
-        updated.resize(buffers.size(), false);
     }
 
     void UniformBufferImpl::destroyImpl() {
+        dropReplacement();
+        dropDirty();
+
         for(auto* buf: buffers)
             delete buf;
 
+        // frames in flight may still read the slot
+
+        if(slotted){
+            GetImpl().retire([slot = slot, size = size](){
+                GetImpl().uniformRing.free(slot, size);
+            });
+            slotted = false;
+        }
+
         buffers.clear();
         updated.clear();
     }
 
     UniformBufferImpl::~UniformBufferImpl() {
+        GetImpl().cancelSwap(this);
+        dropDirty();
+
+        if(slotted)
+            GetImpl().uniformRing.free(slot, size);
+
+        // buffer is destroyed after it was retired, so GPU doesn't use it anymore
+
+        delete replacement;
+
         for(auto* buf: buffers)
             delete buf;
     }
 
+    void UniformBufferImpl::dropReplacement() {
+        GetImpl().cancelSwap(this);
+
+        if(!replacement)
+            return;
+
+        replacement->free();
+        delete replacement;
+        replacement = nullptr;
+    }
+
+    void UniformBufferImpl::dropDirty() {
+        if(std::none_of(updated.begin(), updated.end(), [](bool dirty){ return dirty;}))
+            return;
+
+        for(auto& dirty: GetImpl().dirtyUniformBuffers)
+            std::erase(dirty, this);
+    }
+
     void UniformBufferImpl::update() {
         if(dynamic) {
+            auto& dirty = GetImpl().dirtyUniformBuffers;
+
             int updSize = updated.size();
             for (int i = 0; i < updSize; ++i)
-                updated.at(i) = true;
+                if(!updated.at(i)) {
+                    updated.at(i) = true;
+                    dirty.at(i).push_back(this);
+                }
         } else{
-            auto* buffer = dynamic_cast<Memory::ImmutableBuffer*>(buffers.back());
-            buffer->free();
-            buffer->create(pData, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
-            //assert(0 && "Update of static ubo is not implemented yet");
+            // Frames in flight read current buffer, so data is uploaded to a new one. It takes over
+            // once upload is done and descriptors referring to the buffer are rewritten per image
+
+            dropReplacement();
+
+            replacement = new Memory::ImmutableBuffer{};
+            auto token = replacement->create(pData, size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+
+            GetImpl().swapWhenUploaded(this, token, [this](){
+                dynamic_cast<Memory::ImmutableBuffer*>(buffers.back())->replaceWith(*replacement);
+                delete replacement;
+                replacement = nullptr;
+
+                for(auto& state: GetImpl().cmdBuffersState)
+                    state.descriptorsOutdated = true;
+            });
         }
     }
 
@@ -644,8 +998,7 @@ namespace Vulgine{
         int curFrame = GetImpl().currentBuffer;
 
         if(updated.at(curFrame)){
-             auto* buf = dynamic_cast<Memory::DynamicBuffer*>(buffers.at(curFrame));
-             buf->push(pData);
+            GetImpl().uniformRing.write(curFrame, slot, pData, size);
             updated.at(curFrame) = false;
         }
     }
@@ -710,7 +1063,7 @@ namespace Vulgine{
             binding.binding = i;
             switch (descriptor.type) {
                 case DescriptorInfo::Type::UNIFORM_BUFFER:{
-                    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+                    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
                     break;
                 }
                 case DescriptorInfo::Type::COMBINED_IMAGE_SAMPLER:{
@@ -12,6 +12,7 @@
 #include "vulkan/VulkanDescriptable.h"
 #include "VulgineDescriptorSet.h"
 
+#include <array>
 #include <map>
 
 namespace Vulgine{
@@ -22,10 +23,28 @@ namespace Vulgine{
 
     struct CameraImpl;
     struct SceneImpl;
+    struct RenderPassImpl;
+    struct GeneralPipeline;
+    class MeshImpl;
 
     class UniformBufferImpl: public UniformBuffer, public ObjectImplNoMove{
+
+        // new data of static buffer, it takes place of the current one once uploaded
+
+        Memory::ImmutableBuffer* replacement = nullptr;
+
+        void dropReplacement();
+
+        /** removes buffer from dirty lists of all images */
+        void dropDirty();
+        // slot of dynamic buffer data in uniform ring, taken while buffer is created
+
+        bool slotted = false;
     public:
+        // static buffer only, dynamic data lives in uniform ring
         std::vector<Memory::Buffer*> buffers{};
+        VkDeviceSize slot = 0;
+        // per swap chain image for dynamic buffer
         std::vector<bool> updated{};
         explicit UniformBufferImpl(uint32_t id);
 
@@ -38,6 +57,105 @@ namespace Vulgine{
         ~UniformBufferImpl() override;
     };
 
+    /** byte ranges of data changed since it was last pushed. Too many scattered ranges turn into whole data */
+
+    class DirtyRanges{
+        std::vector<std::pair<size_t, size_t>> ranges;
+        bool all = false;
+
+        static constexpr const size_t maxRanges = 32;
+    public:
+        void mark(size_t begin, size_t end);
+        void markAll() { all = true; ranges.clear();};
+
+        bool empty() const { return !all && ranges.empty();};
+        bool whole() const { return all;};
+
+        /** merged ranges in ascending order */
+        std::vector<std::pair<size_t, size_t>> const& list() const { return ranges;};
+
+        void clear() { all = false; ranges.clear();};
+    };
+
+    /** State set by previous commands recorded to the same command buffer, so it isn't set again.
+     *  Descriptor sets and push constants are tracked for the pipeline layout they were set with */
+
+    class CommandState{
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VkPipelineLayout layout = VK_NULL_HANDLE;
+
+        static constexpr const uint32_t maxSets = 4;
+
+        std::array<DescriptorSet const*, maxSets> sets{};
+        void const* pushedData = nullptr;
+
+        VkBuffer vertices = VK_NULL_HANDLE;
+        VkBuffer instances = VK_NULL_HANDLE;
+        VkBuffer indices = VK_NULL_HANDLE;
+
+        /** returns true if bind is needed */
+        bool change(bool changed);
+    public:
+        uint32_t binds = 0;
+        uint32_t elidedBinds = 0;
+
+        void bindPipeline(VkCommandBuffer commandBuffer, GeneralPipeline const* newPipeline);
+        void bindSet(VkCommandBuffer commandBuffer, uint32_t set, DescriptorSet& descriptorSet, int currentFrame);
+
+        /** data is compared by address, it must not change while command buffer is recorded */
+        void pushConstants(VkCommandBuffer commandBuffer, VkShaderStageFlags stages, void const* data, uint32_t size);
+
+        void bindVertices(VkCommandBuffer commandBuffer, VkBuffer buffer);
+        void bindInstances(VkCommandBuffer commandBuffer, VkBuffer buffer);
+        void bindIndices(VkCommandBuffer commandBuffer, VkBuffer buffer);
+    };
+
+    /** Draw of mesh (or its primitive) resolved in advance: pipeline is found, descriptor sets and static
+     *  buffers are looked up once draw list or any of its meshes changes. Recording only walks the packets */
+
+    struct DrawPacket{
+        GeneralPipeline const* pipeline = nullptr;
+        DescriptorSet* materialSet = nullptr;
+        DescriptorSet* meshSet = nullptr;
+
+        // mesh with dynamic data, which is pushed per frame in flight before packet is recorded and bound by it
+
+        MeshImpl* dynamicMesh = nullptr;
+
+        VkBuffer vertices = VK_NULL_HANDLE;
+        VkBuffer instances = VK_NULL_HANDLE;
+        VkBuffer indices = VK_NULL_HANDLE;     // draw is indexed if set
+
+        uint32_t count = 0;                     // vertices or indices
+        uint32_t instanceCount = 1;
+        uint32_t firstVertex = 0;               // vertex offset of indexed draw
+        uint32_t firstIndex = 0;
+        uint32_t firstInstance = 0;
+
+        // overlay (highlight) draws go after the rest of the pass
+
+        bool overlay = false;
+
+        // render queue order, see SceneImpl::compileDrawPackets
+
+        uint64_t key = 0;
+
+        // Packets up to indirectEnd (exclusive) share every bound state with this one, so they are issued by one
+        // indirect draw starting with command of this packet. Set only for runs of more than one packet,
+        // see RenderPassImpl::buildIndirectCommands
+
+        VkBuffer indirect = VK_NULL_HANDLE;
+        VkDeviceSize indirectOffset = 0;
+        VkDeviceSize countOffset = 0;           // draw count of the whole run
+        size_t indirectEnd = 0;
+
+        /** true if packets may be drawn by one indirect draw: they are indexed and bind the same state */
+        bool sharesState(DrawPacket const& other) const;
+
+        /** binds state of packet and draws it along with drawCount - 1 packets following it in its indirect run */
+        void record(VkCommandBuffer commandBuffer, CameraImpl const* camera, int currentFrame, CommandState& state, uint32_t drawCount = 1) const;
+    };
+
     class MeshImpl: public Mesh, public ObjectImplNoMove{
 
         static MeshImpl* highlighted;
@@ -45,24 +163,54 @@ namespace Vulgine{
 
         void highlight() {highlighted = this;};
         static void clearHighlight() { highlighted = nullptr;}
+        static MeshImpl* highlightedMesh() { return highlighted;}
 
         std::optional<DescriptorSet> set;
 
 
-        struct{
-            void* pData = nullptr;
-            uint32_t count = 0;
-        } cachedVertices;
+        // Dynamic data has buffer per frame in flight. Each of them is written when its frame comes,
+        // so it keeps track of changes made since its last push
+
+        struct DynamicData{
+            Memory::DynamicVertexBuffer* buffer = nullptr;
+            DirtyRanges dirty;
+        };
+
+        std::vector<DynamicData> perVertex;
+        std::vector<DynamicData> perInstance;
 
-        struct{
-            void* pData = nullptr;
-            uint32_t count = 0;
-        } cachedInstances;
+        // Static data lives in shared pools. Draws address it by first vertex, instance and index,
+        // so every mesh keeps the same buffers bound
 
-        std::vector<std::pair<Memory::VertexBuffer*, bool>> perVertex;
-        std::vector<std::pair<Memory::VertexBuffer*, bool>> perInstance;
+        Memory::BufferRegion staticVertices;
+        Memory::BufferRegion staticInstances;
+        Memory::BufferRegion staticIndices;
 
-        Memory::StaticIndexBuffer indexBuffer;
+        // Replacements written by updates of static data. They are swapped in once their uploads are done,
+        // frames keep drawing the current regions meanwhile
+
+        Memory::BufferRegion pendingVertices;
+        Memory::BufferRegion pendingInstances;
+
+        // Identity of static vertex data at its last upload: application array it came from and fingerprint
+        // of its content. Application memory may be gone by the time meshes are compared for automatic
+        // instancing, so only meshes uploaded from the same array with the same content are grouped
+
+        void const* verticesSource = nullptr;
+        uint64_t verticesHash = 0;
+
+        // Fingerprint of indices taken at upload, so recompiles don't compare index vectors
+
+        uint64_t indicesHash = 0;
+
+        void uploadVertices();
+        void uploadInstances();
+        void uploadIndices();
+
+        /** returns regions (along with pending replacements) to pools once frames using them are finished */
+        void releaseVertices();
+        void releaseInstances();
+        void releaseIndices();
 
         explicit MeshImpl(uint32_t id): ObjectImplNoMove(Type::MESH, id){ };
 
@@ -72,13 +220,31 @@ namespace Vulgine{
         void pushVertexBuffer(int id);
         void pushInstanceBuffer(int id);
 
+        /** writes dirty ranges of data to buffer, growing it geometrically if data doesn't fit */
+        static void push(DynamicData& dynamicData, void* pData, size_t size);
+
+        /** creates buffer per frame in flight, each of them is written whole on its first push */
+        static void createDynamicData(std::vector<DynamicData>& data, size_t size, uint32_t binding);
+
         void updateVertexBuffer() override;
 
         void updateIndexBuffer() override;
 
         void updateInstanceBuffer() override;
 
-        void draw(VkCommandBuffer commandBuffer, SceneImpl* scene, CameraImpl *camera, RenderPass* pass, int currentFrame);
+        void updateVertexRange(uint32_t first, uint32_t count) override;
+
+        void updateInstanceRange(uint32_t first, uint32_t count) override;
+
+        /** appends packets drawing the mesh in given pass. Draws of pipelines still being compiled are left out */
+        void compileDrawPackets(SceneImpl* scene, RenderPassImpl* pass, std::vector<DrawPacket>& packets);
+
+        /** Pushes dynamic data of the current frame in flight. Buffers may be recreated, so it's done before
+         *  recording, not by recording threads which may draw the same mesh by several packets */
+        void pushDynamicData();
+
+        /** binds buffers of dynamic data of the current frame in flight, pushed by pushDynamicData() */
+        void bindDynamicData(VkCommandBuffer commandBuffer, CommandState& state);
 
 
         ~MeshImpl() override;
@@ -9,16 +9,16 @@
 
 namespace {
     VkPipelineVertexInputStateCreateInfo* emptyVertexState(){
-        static bool created = false;
-        static VkPipelineVertexInputStateCreateInfo state{};
-
-        if(!created){
-            created = true;
-            state.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-            state.flags = 0;
-            state.vertexAttributeDescriptionCount = 0;
-            state.vertexBindingDescriptionCount = 0;
-        }
+        // pipelines may be compiled concurrently, so rely on thread-safe static initialization
+
+        static VkPipelineVertexInputStateCreateInfo state = [](){
+            VkPipelineVertexInputStateCreateInfo ret{};
+            ret.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+            ret.flags = 0;
+            ret.vertexAttributeDescriptionCount = 0;
+            ret.vertexBindingDescriptionCount = 0;
+            return ret;
+        }();
 
         return &state;
     }
@@ -0,0 +1,321 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#include "VulgineRenderGraph.h"
+#include "Vulgine.h"
+#include "Utilities.h"
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+namespace Vulgine{
+
+    TransientHeap::~TransientHeap() {
+        if(allocation != VK_NULL_HANDLE)
+            vmaFreeMemory(GetImpl().allocator, allocation);
+    }
+
+    void RenderGraph::compile(RenderPassImplRef const& root, std::deque<RenderPassImplRef>& line) {
+        VULGINE_PROFILE_ZONE("compile render graph");
+
+        enum class Mark{ VISITING, DONE };
+
+        std::unordered_map<uint32_t, Mark> marks;
+        std::vector<RenderPassImpl*> path;
+
+        line.clear();
+
+        // depth-first search, pass is placed once all of its dependencies are
+
+        std::function<void(RenderPassImplRef const&)> visit = [&](RenderPassImplRef const& pass){
+            auto mark = marks.find(pass->id());
+
+            if(mark != marks.end()){
+                if(mark->second == Mark::DONE)
+                    return;
+
+                std::string cycle;
+                auto first = std::find(path.begin(), path.end(), pass.get());
+                for(auto it = first; it != path.end(); ++it)
+                    cycle += (*it)->objectLabel() + " -> ";
+                cycle += pass->objectLabel();
+
+                Utilities::ExitFatal(-1, "Render pass dependency cycle: " + cycle);
+            }
+
+            marks[pass->id()] = Mark::VISITING;
+            path.push_back(pass.get());
+
+            for(auto& dependency: pass->dependencies){
+                auto dependencyRef = dependency.lock();
+                if(!dependencyRef){
+                    errs("Render pass " + pass->objectLabel() + " depends on destroyed render pass");
+                    continue;
+                }
+
+                visit(GetImpl().renderPasses.getImpl(dependencyRef->id()));
+            }
+
+            path.pop_back();
+            marks[pass->id()] = Mark::DONE;
+
+            line.push_back(pass);
+        };
+
+        visit(root);
+
+        std::string culled;
+        GetImpl().renderPasses.iterate([&marks, &culled](RenderPassImpl& renderPass){
+            if(!marks.count(renderPass.id()))
+                culled += " " + renderPass.objectLabel();
+        });
+
+        if(!culled.empty())
+            logger("Render graph: passes not contributing to onscreen pass are culled:" + culled);
+    }
+
+    void RenderGraph::build(std::deque<RenderPassImplRef> const& line, std::vector<RenderPassImpl*> const& passes) {
+
+        // transients of the pass share memory with earlier passes in line if any of them has transients too
+
+        bool earlierTransients = false;
+
+        for(auto const& pass: line){
+            if(std::find(passes.begin(), passes.end(), pass.get()) != passes.end()) {
+                pass->graphInfo.aliased = earlierTransients;
+                pass->buildPass();
+            }
+
+            earlierTransients = earlierTransients || !pass->frameBuffer.transientAttachments().empty();
+        }
+
+        allocateTransients(passes);
+
+        for(auto* pass: passes){
+            pass->finishPass();
+            pass->create();
+        }
+    }
+
+    void RenderGraph::rebuildFramebuffers(std::vector<RenderPassImpl*> const& passes) {
+        for(auto* pass: passes){
+            pass->destroyFramebuffer();
+            pass->createFramebuffer();
+        }
+
+        allocateTransients(passes);
+
+        for(auto* pass: passes)
+            pass->completeFramebuffer();
+    }
+
+    std::shared_ptr<TransientHeap> RenderGraph::allocateHeap(VkMemoryRequirements const& memReqs) {
+        VmaAllocationCreateInfo allocCI{};
+        allocCI.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+
+        // on tiled GPUs transient attachments may live in tile memory only
+
+        allocCI.preferredFlags = VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+
+        auto heap = std::make_shared<TransientHeap>();
+
+        VmaAllocationInfo allocInfo;
+        VK_CHECK_RESULT(vmaAllocateMemory(GetImpl().allocator, &memReqs, &allocCI, &heap->allocation, &allocInfo))
+
+        heap->size = memReqs.size;
+        heap->memoryType = allocInfo.memoryType;
+
+        return heap;
+    }
+
+    void RenderGraph::allocateTransients(std::vector<RenderPassImpl*> const& passes) {
+        auto imageCount = GetImpl().swapChain.imageCount;
+
+        heaps.resize(imageCount);
+
+        auto alignUp = [](VkDeviceSize value, VkDeviceSize alignment){
+            return (value + alignment - 1) / alignment * alignment;
+        };
+
+        struct Placement{
+            DynamicImageImpl* image;
+            VkDeviceSize offset;
+        };
+
+        // passes that can share one memory type
+
+        struct Group{
+            std::vector<Placement> placements;
+            VkMemoryRequirements memReqs{0, 1, UINT32_MAX};
+            std::shared_ptr<TransientHeap> heap;
+        };
+
+        VkDeviceSize requested = 0;
+        VkDeviceSize allocated = 0;
+
+        for(uint32_t i = 0; i < imageCount; ++i){
+            std::vector<Group> groups;
+
+            for(auto* pass: passes){
+                auto transients = pass->frameBuffer.transientAttachments();
+
+                if(transients.empty())
+                    continue;
+
+                // pass attachments are placed one after another from the beginning of the heap
+
+                std::vector<Placement> placements;
+                VkDeviceSize offset = 0;
+                VkDeviceSize alignment = 1;
+                uint32_t memoryTypeBits = UINT32_MAX;
+
+                for(auto* image: transients){
+                    auto memReqs = image->images.at(i).memoryRequirements();
+
+                    offset = alignUp(offset, memReqs.alignment);
+                    placements.push_back({image, offset});
+                    offset += memReqs.size;
+
+                    requested += memReqs.size;
+                    alignment = std::max(alignment, memReqs.alignment);
+                    memoryTypeBits &= memReqs.memoryTypeBits;
+                }
+
+                if(memoryTypeBits == 0)
+                    Utilities::ExitFatal(-1, "Transient attachments of render pass " + pass->objectLabel() + " have no common memory type");
+
+                auto group = std::find_if(groups.begin(), groups.end(), [memoryTypeBits](Group const& group){
+                    return (group.memReqs.memoryTypeBits & memoryTypeBits) != 0;
+                });
+
+                if(group == groups.end())
+                    group = groups.emplace(groups.end());
+
+                group->placements.insert(group->placements.end(), placements.begin(), placements.end());
+                group->memReqs.size = std::max(group->memReqs.size, offset);
+                group->memReqs.alignment = std::max(group->memReqs.alignment, alignment);
+                group->memReqs.memoryTypeBits &= memoryTypeBits;
+            }
+
+            // heap left from previous allocation is reused if large enough
+
+            auto& imageHeaps = heaps.at(i);
+
+            for(auto& group: groups){
+                for(auto const& heap: imageHeaps){
+                    bool taken = std::any_of(groups.begin(), groups.end(), [&heap](Group const& another){ return another.heap == heap;});
+
+                    if(!taken && heap->size >= group.memReqs.size && (group.memReqs.memoryTypeBits & (1u << heap->memoryType))){
+                        group.heap = heap;
+                        break;
+                    }
+                }
+
+                if(!group.heap){
+                    group.heap = allocateHeap(group.memReqs);
+                    imageHeaps.push_back(group.heap);
+                }
+
+                allocated += group.heap->size;
+
+                for(auto const& placement: group.placements){
+                    auto* image = placement.image;
+
+                    image->images.at(i).bind(group.heap->allocation, placement.offset);
+
+                    image->heaps.resize(imageCount);
+                    image->heaps.at(i) = group.heap;
+                }
+            }
+
+            // heaps no image is bound to anymore
+
+            imageHeaps.erase(std::remove_if(imageHeaps.begin(), imageHeaps.end(), [](std::shared_ptr<TransientHeap> const& heap){
+                return heap.use_count() == 1;
+            }), imageHeaps.end());
+        }
+
+        if(requested != 0)
+            logger("Render graph: " + std::to_string(requested / 1024) + " KiB of transient attachments placed in " +
+                   std::to_string(allocated / 1024) + " KiB of aliased memory");
+    }
+
+    std::array<VkSubpassDependency, 2> RenderGraph::externalDependencies(RenderPassImpl& pass, uint32_t lastSubpass) {
+        bool depth = false;
+        bool depthSampled = false;
+
+        for(auto& attachment: pass.frameBuffer.attachmentsImages)
+            if(attachment.second->createInfo.usage & VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT){
+                depth = true;
+                depthSampled = !attachment.second->transient;
+            }
+
+        std::array<VkSubpassDependency, 2> dependencies{};
+
+        // Entry: every attachment starts in undefined layout and is cleared. Previous use of the attachments
+        // was in earlier execution of the same command buffer, which is waited on the timeline, so only swap chain
+        // acquire (waited at color output stage) and writes to aliased memory have to be waited here
+
+        auto& entryDependency = dependencies.at(0);
+        entryDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        entryDependency.dstSubpass = 0;
+        entryDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        entryDependency.srcAccessMask = 0;
+        entryDependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        entryDependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        if(depth){
+            entryDependency.dstStageMask |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            entryDependency.dstAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        }
+
+        if(pass.graphInfo.aliased){
+            entryDependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+            entryDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        }
+
+        // Exit: onscreen image goes to presentation (ordered by semaphore) or to readback copy,
+        // offscreen attachments are sampled by dependent passes
+
+        auto& exitDependency = dependencies.at(1);
+        exitDependency.srcSubpass = lastSubpass;
+        exitDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+        exitDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        exitDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        if(pass.onscreen){
+            if(GetImpl().headless){
+                exitDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+                exitDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            } else {
+                exitDependency.dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+                exitDependency.dstAccessMask = 0;
+            }
+        } else {
+            if(depthSampled){
+                exitDependency.srcStageMask |= VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                exitDependency.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+            }
+
+            exitDependency.dstStageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+            exitDependency.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        }
+
+        return dependencies;
+    }
+
+    void RenderGraph::release() {
+        heaps.clear();
+    }
+
+    VkDeviceSize RenderGraph::transientBytes() const {
+        VkDeviceSize ret = 0;
+
+        for(auto const& imageHeaps: heaps)
+            for(auto const& heap: imageHeaps)
+                ret += heap->size;
+
+        return ret;
+    }
+}
@@ -0,0 +1,73 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINERENDERGRAPH_H
+#define TEST_EXE_VULGINERENDERGRAPH_H
+
+#include "vulkan/vulkan.h"
+#include "vma/vk_mem_alloc.h"
+#include "VulgineRenderPass.h"
+#include <array>
+#include <deque>
+#include <memory>
+#include <vector>
+
+namespace Vulgine{
+
+    /** memory shared by transient attachments. Freed once the last image bound to it is destroyed */
+
+    struct TransientHeap{
+        VmaAllocation allocation = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        uint32_t memoryType = 0;
+
+        TransientHeap() = default;
+        TransientHeap(TransientHeap const&) = delete;
+        TransientHeap& operator=(TransientHeap const&) = delete;
+
+        ~TransientHeap();
+    };
+
+    /**
+     * Orders render passes by their dependencies and manages memory of their transient attachments.
+     *
+     * Every pass of the frame is recorded into the same command buffer in graph order, so transient
+     * attachments (G-buffer, MSAA and internal depth targets) of different passes are never alive
+     * at the same time. They are placed in one heap per swap chain image, each pass starting from its
+     * beginning, so the heap takes as much memory as the largest pass needs.
+     * */
+
+    class RenderGraph{
+
+        // per swap chain image
+
+        std::vector<std::vector<std::shared_ptr<TransientHeap>>> heaps;
+
+        static std::shared_ptr<TransientHeap> allocateHeap(VkMemoryRequirements const& memReqs);
+
+    public:
+
+        /** Places every pass root depends on (directly or not) before it, each pass once. Passes unreachable
+         *  from root are culled, as their output is never used. Exits on dependency cycle. */
+        static void compile(RenderPassImplRef const& root, std::deque<RenderPassImplRef>& line);
+
+        /** Builds given passes of compiled line: render pass objects, transient memory and framebuffers */
+        void build(std::deque<RenderPassImplRef> const& line, std::vector<RenderPassImpl*> const& passes);
+
+        /** recreates framebuffers of given passes, e.g. when extents have changed */
+        void rebuildFramebuffers(std::vector<RenderPassImpl*> const& passes);
+
+        /** binds transient attachments of given passes to aliased memory */
+        void allocateTransients(std::vector<RenderPassImpl*> const& passes);
+
+        /** dependencies between pass and commands outside of it: entry into subpass 0 and exit from lastSubpass */
+        static std::array<VkSubpassDependency, 2> externalDependencies(RenderPassImpl& pass, uint32_t lastSubpass);
+
+        void release();
+
+        /** memory held by transient heaps of all swap chain images */
+        VkDeviceSize transientBytes() const;
+    };
+}
+#endif //TEST_EXE_VULGINERENDERGRAPH_H
@@ -8,9 +8,11 @@
 #include "Utilities.h"
 #include "VulgineScene.h"
 #include "vulkan/VulkanInitializers.hpp"
+#include "VulgineRenderGraph.h"
+#include <algorithm>
 
 
-void Vulgine::RenderPassImpl::begin(VkCommandBuffer buffer, int currentFrame) {
+void Vulgine::RenderPassImpl::begin(VkCommandBuffer buffer, int currentFrame, VkSubpassContents contents) {
 
     VkRenderPassBeginInfo renderPassBeginInfo = initializers::renderPassBeginInfo();
     renderPassBeginInfo.renderPass = renderPass;
@@ -22,32 +24,203 @@ void Vulgine::RenderPassImpl::begin(VkCommandBuffer buffer, int currentFrame) {
     renderPassBeginInfo.pClearValues = clearValues.data();
     renderPassBeginInfo.framebuffer = frameBuffer.framebuffers.at(currentFrame);
 
-    vkCmdBeginRenderPass(buffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+    // timestamps can't be written inside subpass recorded in secondary buffers, so first subpass zone is opened here
+
+    auto& profiler = GetImpl().gpuProfiler;
+    profiler.beginZone(buffer, objectLabel());
+    profiler.beginZone(buffer, deferredEnabled ? "G-buffer" : "Geometry");
+
+    vkCmdBeginRenderPass(buffer, &renderPassBeginInfo, contents);
 
 }
 
 void Vulgine::RenderPassImpl::end(VkCommandBuffer buffer) {
     vkCmdEndRenderPass(buffer);
-}
 
-void Vulgine::RenderPassImpl::buildCmdBuffers(VkCommandBuffer buffer, int currentFrame) {
+    // last subpass zone and pass zone
 
+    auto& profiler = GetImpl().gpuProfiler;
+    profiler.endZone(buffer);
+    profiler.endZone(buffer);
+}
 
+void Vulgine::RenderPassImpl::setViewport(VkCommandBuffer buffer) {
     VkViewport viewport = initializers::viewport((float)framebufferExtents.width, (float)framebufferExtents.height, 0.0f, 1.0f);
     vkCmdSetViewport(buffer, 0, 1, &viewport);
 
     VkRect2D scissor = initializers::rect2D(framebufferExtents.width, framebufferExtents.height, 0, 0);
     vkCmdSetScissor(buffer, 0, 1, &scissor);
+}
+
+void Vulgine::RenderPassImpl::drawTail(VkCommandBuffer buffer, int currentFrame) {
+    dynamic_cast<SceneImpl*>(scene.get())->drawBackground(buffer, dynamic_cast<CameraImpl*>(camera.get()), this, currentFrame);
+
+    if(onscreen){
+        auto& profiler = GetImpl().gpuProfiler;
+        profiler.beginZone(buffer, "GUI");
+        GetImpl().gui.draw(buffer, currentFrame);
+        profiler.endZone(buffer);
+    }
+}
+
+void Vulgine::RenderPassImpl::compileDrawPackets() {
+    auto& vlg = GetImpl();
+
+    if(drawPacketsRevision == vlg.drawRevision)
+        return;
+
+    dynamic_cast<SceneImpl*>(scene.get())->compileDrawPackets(this, drawPackets);
+    buildIndirectCommands();
+    drawPacketsRevision = vlg.drawRevision;
+}
+
+void Vulgine::RenderPassImpl::buildIndirectCommands() {
+    auto& vlg = GetImpl();
+
+    // command buffers recorded earlier may still be executed
+
+    if(indirectCommands)
+        vlg.retire([buffer = indirectCommands.release()](){ delete buffer; });
+
+    auto const& features = vlg.device->enabledFeatures;
+
+    if(!vlg.settings.indirectDraws || !features.multiDrawIndirect || !features.drawIndirectFirstInstance)
+        return;
+
+    size_t maxRun = vlg.device->properties.limits.maxDrawIndirectCount;
+
+    std::vector<VkDrawIndexedIndirectCommand> commands;
+    std::vector<uint32_t> counts;
+
+    for(size_t first = 0; first < drawPackets.size();){
+        auto end = first + 1;
+
+        while(end < drawPackets.size() && end - first < maxRun && drawPackets[first].sharesState(drawPackets[end]))
+            ++end;
+
+        if(end - first > 1) {
+            for (auto i = first; i < end; ++i) {
+                auto& packet = drawPackets[i];
+
+                packet.indirectOffset = commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+                packet.countOffset = counts.size() * sizeof(uint32_t);
+                packet.indirectEnd = end;
+
+                commands.push_back({packet.count, packet.instanceCount, packet.firstIndex,
+                                    static_cast<int32_t>(packet.firstVertex), packet.firstInstance});
+            }
+
+            counts.push_back(end - first);
+        }
+
+        first = end;
+    }
+
+    if(commands.empty())
+        return;
+
+    // counts go after all commands
+
+    auto commandBytes = commands.size() * sizeof(VkDrawIndexedIndirectCommand);
+    auto countBytes = counts.size() * sizeof(uint32_t);
+
+    indirectCommands = std::make_unique<Memory::IndirectBuffer>();
+    indirectCommands->create(commandBytes + countBytes);
+    indirectCommands->push(commands.data(), commandBytes);
+    indirectCommands->push(counts.data(), countBytes, commandBytes);
+
+    for(auto& packet: drawPackets){
+        if(packet.indirectEnd == 0)
+            continue;
+
+        packet.indirect = indirectCommands->buffer;
+        packet.countOffset += commandBytes;
+    }
+}
+
+void Vulgine::RenderPassImpl::pushDynamicData() {
+    for(auto const& packet: drawPackets)
+        if(packet.dynamicMesh)
+            packet.dynamicMesh->pushDynamicData();
+}
+
+bool Vulgine::RenderPassImpl::recordsInParallel() const {
+    auto& vlg = GetImpl();
+    auto workers = vlg.recordingThreads.size();
+
+    return workers > 1 && drawPackets.size() >= 2 * vlg.settings.minMeshesPerRecordingThread;
+}
+
+void Vulgine::RenderPassImpl::recordGeometrySubpassParallel(VkCommandBuffer buffer, int currentFrame) {
+    auto& vlg = GetImpl();
+    auto* cameraImpl = dynamic_cast<CameraImpl*>(camera.get());
+
+    size_t packetCount = drawPackets.size();
+    size_t chunkCount = std::min<size_t>(vlg.recordingThreads.size(), packetCount / vlg.settings.minMeshesPerRecordingThread);
+    chunkCount = std::max<size_t>(chunkCount, 1);
+    size_t chunkSize = (packetCount + chunkCount - 1) / chunkCount;
+
+    // in forward mode background and overlay are drawn in the same subpass, so they go to additional buffer
+
+    std::vector<VkCommandBuffer> secondaries(chunkCount + (deferredEnabled ? 0 : 1));
+
+    for(size_t chunk = 0; chunk < chunkCount; ++chunk){
+        size_t first = chunk * chunkSize;
+        size_t last = std::min(first + chunkSize, packetCount);
+
+        vlg.recordingThreads.push([this, &vlg, &secondaries, cameraImpl, currentFrame, chunk, first, last](){
+            VULGINE_PROFILE_ZONE("record draw chunk");
+            auto secondary = vlg.beginSecondaryCommandBuffer(currentFrame, chunk, this, 0);
+            setViewport(secondary);
+            SceneImpl::draw(secondary, cameraImpl, drawPackets, currentFrame, first, last);
+            VK_CHECK_RESULT(vkEndCommandBuffer(secondary));
+            secondaries.at(chunk) = secondary;
+        });
+    }
+
+    // main thread records its part while workers are busy, using the last slot
+
+    if(!deferredEnabled){
+        auto secondary = vlg.beginSecondaryCommandBuffer(currentFrame, vlg.recordingThreads.size(), this, 0);
+        setViewport(secondary);
+        drawTail(secondary, currentFrame);
+        VK_CHECK_RESULT(vkEndCommandBuffer(secondary));
+        secondaries.back() = secondary;
+    }
+
+    vlg.recordingThreads.wait();
+
+    vkCmdExecuteCommands(buffer, secondaries.size(), secondaries.data());
+}
+
+void Vulgine::RenderPassImpl::buildCmdBuffers(VkCommandBuffer buffer, int currentFrame, bool parallel) {
 
     //draw scene from perspective of specified camera
 
-    dynamic_cast<SceneImpl*>(scene.get())->draw(buffer, dynamic_cast<CameraImpl*>(camera.get()), this, currentFrame);
+    if(parallel){
+        recordGeometrySubpassParallel(buffer, currentFrame);
+    } else {
+        setViewport(buffer);
 
-    if(!deferredEnabled)
-        dynamic_cast<SceneImpl*>(scene.get())->drawBackground(buffer, dynamic_cast<CameraImpl*>(camera.get()), this, currentFrame);
+        SceneImpl::draw(buffer, dynamic_cast<CameraImpl *>(camera.get()), drawPackets, currentFrame, 0, drawPackets.size());
+
+        if (!deferredEnabled)
+            drawTail(buffer, currentFrame);
+    }
 
     if(deferredEnabled){
+        auto& profiler = GetImpl().gpuProfiler;
+
         vkCmdNextSubpass(buffer, VK_SUBPASS_CONTENTS_INLINE);
+
+        profiler.endZone(buffer);
+        profiler.beginZone(buffer, "Deferred composition");
+
+        // dynamic state is undefined after executing secondary command buffers
+
+        if(parallel)
+            setViewport(buffer);
+
         deferredLightingSubpass.pipeline.bind(buffer);
         deferredLightingSubpass.compositionSet.bind(0, buffer,
                                                     deferredLightingSubpass.pipeline.pipelineLayout,
@@ -60,7 +233,10 @@ void Vulgine::RenderPassImpl::buildCmdBuffers(VkCommandBuffer buffer, int curren
 
         vkCmdNextSubpass(buffer, VK_SUBPASS_CONTENTS_INLINE);
 
-        dynamic_cast<SceneImpl*>(scene.get())->drawBackground(buffer, dynamic_cast<CameraImpl*>(camera.get()), this, currentFrame);
+        profiler.endZone(buffer);
+        profiler.beginZone(buffer, "Transparent");
+
+        drawTail(buffer, currentFrame);
         // TODO: invoke transparent material draw list in scene
     }
 
@@ -105,9 +281,9 @@ void Vulgine::RenderPassImpl::buildPass() {
         attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attachments[0].initialLayout = onscreen ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
         attachments[0].finalLayout = !onscreen ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL :
-                                     VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                                     GetImpl().onscreenFinalLayout();
 
         // G-Buffer position
         attachments[1].format = FrameBufferImpl::GBufferPosFormat;
@@ -143,7 +319,7 @@ void Vulgine::RenderPassImpl::buildPass() {
         attachments[4].format = depthFormat;
         attachments[4].samples = VK_SAMPLE_COUNT_1_BIT;
         attachments[4].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        attachments[4].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        attachments[4].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         attachments[4].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
         attachments[4].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         attachments[4].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -201,41 +377,33 @@ void Vulgine::RenderPassImpl::buildPass() {
         subpassDescriptions[2].inputAttachmentCount = 1;
         subpassDescriptions[2].pInputAttachments = inputReferences;
 
-        // Subpass dependencies for layout transitions
-        std::array<VkSubpassDependency, 4> dependencies;
+        // Subpass dependencies for layout transitions. External ones are derived by render graph
+        std::array<VkSubpassDependency, 4> dependencies{};
+
+        auto external = RenderGraph::externalDependencies(*this, 2);
 
-        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[0].dstSubpass = 0;
-        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        dependencies[0] = external.at(0);
 
         // This dependency transitions the input attachment from color attachment to shader read
         dependencies[1].srcSubpass = 0;
         dependencies[1].dstSubpass = 1;
-        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                        VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
         dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
         dependencies[2].srcSubpass = 1;
         dependencies[2].dstSubpass = 2;
         dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        dependencies[2].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
         dependencies[2].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[2].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        dependencies[2].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
         dependencies[2].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
-        dependencies[3].srcSubpass = 0;
-        dependencies[3].dstSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[3].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[3].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[3].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[3].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[3].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+        dependencies[3] = external.at(1);
 
         VkRenderPassCreateInfo renderPassInfo = {};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -249,12 +417,7 @@ void Vulgine::RenderPassImpl::buildPass() {
         VK_CHECK_RESULT(vkCreateRenderPass(GetImpl().device->logicalDevice, &renderPassInfo, nullptr, &renderPass));
 
 
-        // Now must setup descriptors
-
-
-
-        deferredLightingSubpass.pipeline.renderPass = this;
-        deferredLightingSubpass.pipeline.create();
+        // descriptors and composition pipeline are set up by finishPass(), once G-buffer is bound to memory
 
         clearValues.resize(5);
         for(int i = 0; i < 4; i++)
@@ -273,18 +436,18 @@ void Vulgine::RenderPassImpl::buildPass() {
             attachments[0].format = colorTargetFormat;
             attachments[0].samples = GetImpl().settings.msaa;
             attachments[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            attachments[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachments[0].storeOp = GetImpl().settings.msaa > 1 ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
             attachments[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
             attachments[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             attachments[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
             attachments[0].finalLayout = GetImpl().settings.msaa > 1 ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
-                                         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                                         GetImpl().onscreenFinalLayout();
 
             // Depth attachment
             attachments[1].format = depthFormat;
             attachments[1].samples = GetImpl().settings.msaa;
             attachments[1].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+            attachments[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             attachments[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
             attachments[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
             attachments[1].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -300,7 +463,7 @@ void Vulgine::RenderPassImpl::buildPass() {
                 attachments[2].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
                 attachments[2].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
                 attachments[2].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                attachments[2].finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                attachments[2].finalLayout = GetImpl().onscreenFinalLayout();
             }
 
             VkAttachmentReference colorReference = {};
@@ -328,23 +491,7 @@ void Vulgine::RenderPassImpl::buildPass() {
             subpassDescription.pResolveAttachments = GetImpl().settings.msaa > 1 ? &colorAttachmentResolveRef : nullptr;
 
             // Subpass dependencies for layout transitions
-            std::array<VkSubpassDependency, 2> dependencies{};
-
-            dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[0].dstSubpass = 0;
-            dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-            dependencies[1].srcSubpass = 0;
-            dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+            auto dependencies = RenderGraph::externalDependencies(*this, 0);
 
             VkRenderPassCreateInfo renderPassInfo = {};
             renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -390,9 +537,9 @@ void Vulgine::RenderPassImpl::buildPass() {
                 attachments.at(binding).stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
                 attachments.at(binding).stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
-                // for now we consider it to be shader read-only optimal
+                // attachment is cleared anyway, so previous contents may be discarded
 
-                attachments.at(binding).initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+                attachments.at(binding).initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 
                 // for now we consider it to be used as sampled image
 
@@ -427,25 +574,7 @@ void Vulgine::RenderPassImpl::buildPass() {
             subpassDescription.pResolveAttachments = nullptr;
 
             // Subpass dependencies for layout transitions
-            std::array<VkSubpassDependency, 2> dependencies{};
-
-            // TODO: deduct external dependencies by framebuffer images use info
-
-            dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[0].dstSubpass = 0;
-            dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
-            dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-            dependencies[1].srcSubpass = 0;
-            dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[1].dstStageMask = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
-            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-            dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+            auto dependencies = RenderGraph::externalDependencies(*this, 0);
 
             VkRenderPassCreateInfo renderPassInfo = {};
             renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -463,8 +592,24 @@ void Vulgine::RenderPassImpl::buildPass() {
 
     }
 
-    frameBuffer.create();
+}
+
+void Vulgine::RenderPassImpl::finishPass() {
+    completeFramebuffer();
+
+    if(deferredEnabled){
+        deferredLightingSubpass.pipeline.renderPass = this;
+        deferredLightingSubpass.pipeline.create();
+    }
+}
+
+void Vulgine::RenderPassImpl::completeFramebuffer() {
+    frameBuffer.createTransientViews();
+
+    if(deferredEnabled)
+        createInputAttachmentSets();
 
+    frameBuffer.create();
 }
 
 void Vulgine::RenderPassImpl::createFramebuffer() {
@@ -487,8 +632,9 @@ void Vulgine::RenderPassImpl::createFramebuffer() {
             {
                 if(GetImpl().settings.msaa > 1) { // using MSAA here
                     frameBuffer.createAttachment(GetImpl().swapChain.colorFormat,
-                                                                         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, GetImpl().settings.msaa);
-                    frameBuffer.addAttachment(AttachmentType::DEPTH_STENCIL);
+                                                 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT,
+                                                 GetImpl().settings.msaa, true);
+                    frameBuffer.createTransientDepth(GetImpl().settings.msaa);
 
 
                     std::vector<VkImageView> views;
@@ -503,7 +649,7 @@ void Vulgine::RenderPassImpl::createFramebuffer() {
                     }
                     frameBuffer.addOnsrceenAttachment(views);
 
-                    frameBuffer.addAttachment(AttachmentType::DEPTH_STENCIL);
+                    frameBuffer.createTransientDepth(VK_SAMPLE_COUNT_1_BIT);
                 }
                 return;
             }
@@ -520,43 +666,40 @@ void Vulgine::RenderPassImpl::createFramebuffer() {
         if(deferred)
             frameBuffer.createGBuffer();
 
-        frameBuffer.addAttachment(AttachmentType::DEPTH_STENCIL);
+        frameBuffer.createTransientDepth(VK_SAMPLE_COUNT_1_BIT);
     }
+}
 
+void Vulgine::RenderPassImpl::createInputAttachmentSets() {
+    deferredLightingSubpass.compositionSet.clearDescriptors();
+    deferredLightingSubpass.transparentSet.clearDescriptors();
 
-    if(deferred){
-
-        deferredLightingSubpass.compositionSet.clearDescriptors();
-        deferredLightingSubpass.transparentSet.clearDescriptors();
-
-        deferredLightingSubpass.compositionSet.destroy();
-        deferredLightingSubpass.transparentSet.destroy();
-        deferredLightingSubpass.compositionSet.pool = &GetImpl().perRenderPassPool;
-
-        std::vector<VkImageView> views1, views2, views3;
-        views1.reserve(GetImpl().swapChain.imageCount);
-        views2.reserve(GetImpl().swapChain.imageCount);
-        views3.reserve(GetImpl().swapChain.imageCount);
+    deferredLightingSubpass.compositionSet.destroy();
+    deferredLightingSubpass.transparentSet.destroy();
+    deferredLightingSubpass.compositionSet.pool = &GetImpl().perRenderPassPool;
 
-        for(int i = 0; i < GetImpl().swapChain.imageCount; i++){
-            views1.push_back(frameBuffer.attachments.at(i).at(1));
-            views2.push_back(frameBuffer.attachments.at(i).at(2));
-            views3.push_back(frameBuffer.attachments.at(i).at(3));
-        }
-        deferredLightingSubpass.compositionSet.addInputAttachment(views1, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.compositionSet.addInputAttachment(views2, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.compositionSet.addInputAttachment(views3, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.compositionSet.addUniformBuffer(dynamic_cast<SceneImpl*>(scene.get())->lightUBO, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.compositionSet.create();
+    std::vector<VkImageView> views1, views2, views3;
+    views1.reserve(GetImpl().swapChain.imageCount);
+    views2.reserve(GetImpl().swapChain.imageCount);
+    views3.reserve(GetImpl().swapChain.imageCount);
 
+    for(int i = 0; i < GetImpl().swapChain.imageCount; i++){
+        views1.push_back(frameBuffer.attachments.at(i).at(1));
+        views2.push_back(frameBuffer.attachments.at(i).at(2));
+        views3.push_back(frameBuffer.attachments.at(i).at(3));
+    }
+    deferredLightingSubpass.compositionSet.addInputAttachment(views1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.compositionSet.addInputAttachment(views2, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.compositionSet.addInputAttachment(views3, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.compositionSet.addUniformBuffer(dynamic_cast<SceneImpl*>(scene.get())->lightUBO, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.compositionSet.create();
 
-        deferredLightingSubpass.transparentSet.pool = &GetImpl().perRenderPassPool;
 
-        deferredLightingSubpass.transparentSet.addInputAttachment(views1, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.transparentSet.addUniformBuffer(dynamic_cast<SceneImpl*>(scene.get())->lightUBO, VK_SHADER_STAGE_FRAGMENT_BIT);
-        deferredLightingSubpass.transparentSet.create();
+    deferredLightingSubpass.transparentSet.pool = &GetImpl().perRenderPassPool;
 
-    }
+    deferredLightingSubpass.transparentSet.addInputAttachment(views1, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.transparentSet.addUniformBuffer(dynamic_cast<SceneImpl*>(scene.get())->lightUBO, VK_SHADER_STAGE_FRAGMENT_BIT);
+    deferredLightingSubpass.transparentSet.create();
 }
 
 void Vulgine::RenderPassImpl::destroyFramebuffer() {
@@ -8,6 +8,7 @@
 #include "vulkan/vulkan.h"
 #include "VulgineFramebuffer.h"
 #include "VulginePipeline.h"
+#include <memory>
 namespace Vulgine{
 
     struct RenderPassImpl: public RenderPass, public ObjectImplNoMove{
@@ -62,9 +63,22 @@ namespace Vulgine{
         DeferredLighting deferredLightingSubpass;
         bool deferredEnabled = false;
 
+        /** declares attachments. Transient ones get no memory here, see completeFramebuffer() */
         void createFramebuffer();
         void destroyFramebuffer();
 
+        /** creates framebuffer objects. Transient attachments must be bound to memory by now */
+        void completeFramebuffer();
+
+        // filled by render graph before pass is built
+
+        struct GraphInfo{
+
+            // transient attachments share memory with ones of passes executed earlier in the frame
+
+            bool aliased = false;
+        } graphInfo;
+
 
 
 
@@ -82,14 +96,56 @@ namespace Vulgine{
 
         void initFrameBuffer(SharedRef<RenderPassImpl> const& thisRef);
 
+        /** Pass is built in two steps, so render graph can bind transient attachments of all passes to shared
+         *  memory in between. buildPass() creates render pass object and declares attachments, finishPass()
+         *  creates framebuffer and objects depending on attachment views.
+         */
         void buildPass();
+        void finishPass();
+
+        void begin(VkCommandBuffer buffer, int currentFrame, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
+
+        // draws of scene in this pass, compiled for drawRevision of engine
+
+        std::vector<DrawPacket> drawPackets;
+        uint64_t drawPacketsRevision = 0;
+
+        // commands of indirect runs of draw packets, replaced each time packets are compiled
 
-        void begin(VkCommandBuffer buffer, int currentFrame);
+        std::unique_ptr<Memory::IndirectBuffer> indirectCommands;
 
-        void buildCmdBuffers(VkCommandBuffer buffer, int currentFrame);
+        /** compiles draw packets again if recorded commands got outdated since they were compiled */
+        void compileDrawPackets();
+
+        /** pushes data of dynamic meshes drawn by packets for the current frame in flight. Must be done before
+         *  packets are recorded */
+        void pushDynamicData();
+
+        /** Joins sorted packets sharing their state into runs drawn by one multi draw indirect call each.
+         *  Needs multiDrawIndirect and drawIndirectFirstInstance features, packets are drawn directly without them */
+        void buildIndirectCommands();
+
+        /** true if geometry subpass is worth splitting between recording threads.
+         *  In this case pass must be began with VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS.
+         */
+        bool recordsInParallel() const;
+
+        void buildCmdBuffers(VkCommandBuffer buffer, int currentFrame, bool parallel = false);
 
         void end(VkCommandBuffer buffer);
 
+    private:
+        void setViewport(VkCommandBuffer buffer);
+
+        // draws background and (for onscreen pass) ui overlay - last things in the pass
+
+        void drawTail(VkCommandBuffer buffer, int currentFrame);
+
+        void recordGeometrySubpassParallel(VkCommandBuffer buffer, int currentFrame);
+
+        void createInputAttachmentSets();
+    public:
+
         ~RenderPassImpl() override;
     protected:
         void createImpl() override;
@@ -7,10 +7,101 @@
 #include "VulgineRenderPass.h"
 #include "Utilities.h"
 #include <algorithm>
+#include <array>
 #include "Vulgine.h"
 
 namespace Vulgine{
 
+    namespace {
+
+        /** Gives objects dense ranks in order of their first appearance, so they fit into few bits of
+         *  sort key and groups keep draw list order. Ranks beyond the field share its last value */
+
+        class Ranks{
+            std::unordered_map<uint64_t, uint64_t> ranks;
+            uint64_t max;
+        public:
+            explicit Ranks(uint32_t bits): max((1ull << bits) - 1){}
+
+            /** object is either pointer or Vulkan handle */
+            template<typename Handle>
+            uint64_t operator()(Handle object){
+                return ranks.emplace((uint64_t)object, std::min<uint64_t>(ranks.size(), max)).first->second;
+            }
+        };
+
+        /** stable LSD radix sort by packet keys, byte per pass. Bytes equal in every key are skipped */
+
+        void radixSort(std::vector<DrawPacket>& packets){
+            std::vector<std::pair<uint64_t, uint32_t>> items(packets.size());
+            std::vector<std::pair<uint64_t, uint32_t>> scratch(packets.size());
+
+            for(uint32_t i = 0; i < packets.size(); ++i)
+                items[i] = {packets[i].key, i};
+
+            for(uint32_t shift = 0; shift < 64; shift += 8){
+                std::array<size_t, 257> offsets{};
+
+                for(auto const& item: items)
+                    offsets[((item.first >> shift) & 0xFF) + 1]++;
+
+                if(std::any_of(offsets.begin(), offsets.end(), [&items](size_t count){ return count == items.size();}))
+                    continue;
+
+                for(size_t i = 1; i < offsets.size(); ++i)
+                    offsets[i] += offsets[i - 1];
+
+                for(auto const& item: items)
+                    scratch[offsets[(item.first >> shift) & 0xFF]++] = item;
+
+                items.swap(scratch);
+            }
+
+            std::vector<DrawPacket> sorted;
+            sorted.reserve(packets.size());
+
+            for(auto const& item: items)
+                sorted.push_back(packets[item.second]);
+
+            packets.swap(sorted);
+        }
+
+        void retireInstances(Memory::BufferRegion region){
+            GetImpl().retire([region](){ GetImpl().vertexPool.free(region); });
+        }
+
+        /** Mesh may be drawn as an instance of another one: both vertices and instances are static and
+         *  already in the vertex pool, where batch copies instances from */
+
+        bool instanceable(MeshImpl const& mesh){
+            return mesh.isCreated() && !mesh.vertices.dynamic && !mesh.instances.dynamic && mesh.instances.count > 0 &&
+                   mesh.staticVertices && !mesh.pendingVertices && mesh.staticInstances &&
+                   &mesh != MeshImpl::highlightedMesh();
+        }
+
+        /** Meshes draw the same vertices by the same primitives with the same descriptors. Vertices must come
+         *  from the same application array, content is checked by the fingerprint taken at upload, so arrays
+         *  reused for other data aren't mistaken for the same one. Application memory isn't read */
+
+        bool sameDraw(MeshImpl const& lhs, MeshImpl const& rhs){
+            if(lhs.geometry.get() != rhs.geometry.get() || lhs.verticesSource != rhs.verticesSource ||
+               lhs.verticesHash != rhs.verticesHash || lhs.staticVertices.size != rhs.staticVertices.size ||
+               lhs.indices.size() != rhs.indices.size() || lhs.indicesHash != rhs.indicesHash)
+                return false;
+
+            auto samePrimitive = [](Mesh::Primitive const& a, Mesh::Primitive const& b){
+                return a.material.get() == b.material.get() && a.startIdx == b.startIdx && a.indexCount == b.indexCount;
+            };
+
+            auto sameDescriptor = [](Descriptor const& a, Descriptor const& b){
+                return a.ubo.get() == b.ubo.get() && a.sampler.get() == b.sampler.get() && a.image.get() == b.image.get();
+            };
+
+            return std::equal(lhs.primitives.begin(), lhs.primitives.end(), rhs.primitives.begin(), rhs.primitives.end(), samePrimitive) &&
+                   std::equal(lhs.descriptors.begin(), lhs.descriptors.end(), rhs.descriptors.begin(), rhs.descriptors.end(), sameDescriptor);
+        }
+    }
+
 
 
 
@@ -45,20 +136,188 @@ namespace Vulgine{
         lights.erase(id);
     }
 
-    void SceneImpl::draw(VkCommandBuffer commandBuffer, CameraImpl *camera, RenderPass* pass, int currentFrame) {
+    void SceneImpl::compileDrawPackets(RenderPassImpl *pass, std::vector<DrawPacket> &packets) {
+        VULGINE_PROFILE_ZONE("compile draw packets");
+
+        packets.clear();
+
+        removeExpiredMeshes();
+
+        auto batched = compileInstanceBatches();
+
+        for(auto const& mesh: drawList) {
+            auto meshPtr = mesh.lock();
+            if(!meshPtr)
+                continue;
+
+            auto* meshImpl = dynamic_cast<MeshImpl *>(meshPtr.get());
+
+            auto batchIt = batched.find(meshImpl);
+            if(batchIt == batched.end()){
+                meshImpl->compileDrawPackets(this, pass, packets);
+                continue;
+            }
+
+            // batch is drawn in place of its first mesh, the rest of meshes are its instances
+
+            auto const& batch = instanceBatches.at(batchIt->second);
+            if(batch.meshes.front() != meshImpl)
+                continue;
+
+            auto first = packets.size();
+            auto stride = meshImpl->geometry->vertexFormat.perInstanceSize();
+
+            meshImpl->compileDrawPackets(this, pass, packets);
+
+            for(auto i = first; i < packets.size(); ++i){
+                packets[i].instances = batch.instances.buffer;
+                packets[i].firstInstance = batch.instances.offset / stride;
+                packets[i].instanceCount = batch.instanceCount;
+            }
+        }
+
+        // Render queue key, most expensive state change first:
+        //   63    overlay
+        //   62-48 pipeline
+        //   47-32 material descriptor set
+        //   31-16 vertex buffer
+        //   15-0  instance buffer
+        // Meshes have no transform of their own, so there is no depth to order opaque draws by
+
+        Ranks pipelines{15}, materialSets{16}, vertexBuffers{16}, instanceBuffers{16};
+
+        for(auto& packet: packets)
+            packet.key = static_cast<uint64_t>(packet.overlay) << 63 |
+                         pipelines(packet.pipeline) << 48 |
+                         materialSets(packet.materialSet) << 32 |
+                         vertexBuffers(packet.vertices) << 16 |
+                         instanceBuffers(packet.instances);
+
+        radixSort(packets);
+    }
+
+    void SceneImpl::draw(VkCommandBuffer commandBuffer, CameraImpl *camera, std::vector<DrawPacket> const& packets, int currentFrame, size_t first, size_t last) {
+        CommandState state{};
+
+        for(auto i = first; i < last;) {
+            auto const& packet = packets[i];
+
+            // run of indirect draws is cut by the end of range, next range records the rest of it
+
+            uint32_t drawCount = packet.indirect ? std::min(packet.indirectEnd, last) - i : 1;
+
+            packet.record(commandBuffer, camera, currentFrame, state, drawCount);
+
+            i += drawCount;
+        }
+
+        GetImpl().recordedBinds += state.binds;
+        GetImpl().elidedBinds += state.elidedBinds;
+    }
+
+    std::unordered_map<MeshImpl*, size_t> SceneImpl::compileInstanceBatches() {
+        auto& vlg = GetImpl();
+
+        std::vector<InstanceBatch> previous;
+        previous.swap(instanceBatches);
+
+        std::unordered_map<MeshImpl*, size_t> batched;
+
+        if(vlg.settings.autoInstancing) {
+
+            // candidate batches by vertex data, meshes of a batch must draw the same vertices
+
+            std::unordered_map<uint64_t, std::vector<size_t>> candidates;
+
+            for (auto const& mesh: drawList) {
+                auto meshPtr = mesh.lock();
+                if (!meshPtr)
+                    continue;
+
+                auto* meshImpl = dynamic_cast<MeshImpl*>(meshPtr.get());
+
+                if (!instanceable(*meshImpl) || batched.count(meshImpl))
+                    continue;
+
+                auto& sameVertices = candidates[meshImpl->verticesHash];
+
+                auto batchIt = std::find_if(sameVertices.begin(), sameVertices.end(), [this, meshImpl](size_t batch) {
+                    return sameDraw(*instanceBatches.at(batch).meshes.front(), *meshImpl);
+                });
+
+                if (batchIt == sameVertices.end()) {
+                    sameVertices.push_back(instanceBatches.size());
+                    batchIt = std::prev(sameVertices.end());
+                    instanceBatches.emplace_back();
+                }
+
+                auto& batch = instanceBatches.at(*batchIt);
+                batch.meshes.push_back(meshImpl);
+
+                auto const& instances = meshImpl->staticInstances;
+                auto stride = meshImpl->geometry->vertexFormat.perInstanceSize();
+
+                batch.sources.emplace_back(meshImpl->id(), instances.buffer, instances.offset, instances.size);
+                batch.instanceCount += instances.size / stride;
+
+                batched.emplace(meshImpl, *batchIt);
+            }
+        }
+
+        // single meshes are drawn as they are
+
+        for(auto const& batch: instanceBatches)
+            if(batch.meshes.size() == 1)
+                batched.erase(batch.meshes.front());
+
+        for(auto& batch: instanceBatches){
+            if(batch.meshes.size() == 1)
+                continue;
+
+            auto sameSources = std::find_if(previous.begin(), previous.end(), [&batch](InstanceBatch const& old){
+                return old.instances && old.sources == batch.sources;
+            });
 
-        // draw all the meshes
+            if(sameSources != previous.end()){
+                batch.instances = sameSources->instances;
+                sameSources->instances = Memory::BufferRegion{};
+                continue;
+            }
+
+            auto stride = batch.meshes.front()->geometry->vertexFormat.perInstanceSize();
+
+            // Instances are gathered from pool regions of meshes on GPU. Region is used at once,
+            // GPU orders draws after the copies
+
+            batch.instances = vlg.vertexPool.allocate(batch.instanceCount * stride, stride);
 
-        for(auto it = drawList.begin(), end = drawList.end(); it != end;) {
-            auto meshPtr = it->lock();
-            if(meshPtr) {
-                dynamic_cast<MeshImpl *>(meshPtr.get())->draw(commandBuffer, this, camera, pass, currentFrame);
-                ++it;
-            } else{
-                it = drawList.erase(it);
-                end = drawList.end();
+            VkDeviceSize offset = 0;
+
+            for(auto* mesh: batch.meshes) {
+                vlg.vertexPool.copy(mesh->staticInstances, batch.instances, offset);
+                offset += mesh->staticInstances.size;
             }
         }
+
+        // regions of batches that changed or broke up
+
+        for(auto const& old: previous)
+            if(old.instances)
+                retireInstances(old.instances);
+
+        return batched;
+    }
+
+    void SceneImpl::releaseInstanceBatches() {
+        for(auto const& batch: instanceBatches)
+            if(batch.instances)
+                retireInstances(batch.instances);
+
+        instanceBatches.clear();
+    }
+
+    void SceneImpl::removeExpiredMeshes() {
+        drawList.erase(std::remove_if(drawList.begin(), drawList.end(), [](WeakRef<Mesh> const& mesh){ return mesh.expired();}), drawList.end());
     }
 
     CameraRef SceneImpl::createCamera() {
@@ -82,9 +341,19 @@ namespace Vulgine{
         lights.clear();
         cameras.clear();
         lightUBO->destroy();
+        releaseInstanceBatches();
 
     }
 
+    SceneImpl::~SceneImpl() {
+
+        // scene is destroyed after it was retired, so GPU doesn't use its batches anymore
+
+        for(auto& batch: instanceBatches)
+            if(batch.instances)
+                GetImpl().vertexPool.free(batch.instances);
+    }
+
     void SceneImpl::updateLight(uint32_t light) {
         auto lightNumber = lightMap.at(light);
         lightsInfo.lights[lightNumber].lightColor = glm::vec4{lights.at(light)->color, 0.0f};
@@ -113,6 +382,7 @@ namespace Vulgine{
 
         background.material.create();
 
+        GetImpl().cmdBuffersOutdated = true;
     }
 
     void SceneImpl::deleteBackGround() {
@@ -121,16 +391,22 @@ namespace Vulgine{
 
         background.created = false;
         background.material.destroy();
+
+        GetImpl().cmdBuffersOutdated = true;
     }
 
     void SceneImpl::drawBackground(VkCommandBuffer commandBuffer, CameraImpl* camera, RenderPass* pass, int currentFrame) {
         // draw background
 
         if(background.created){
-            auto& pipeline = GetImpl().pipelineMap.bind({nullptr, &background.material, this, dynamic_cast<RenderPassImpl*>(pass)}, commandBuffer);
+            auto* pipeline = GetImpl().pipelineMap.bind({nullptr, &background.material, this, dynamic_cast<RenderPassImpl*>(pass)}, commandBuffer);
+
+            // still compiling
+            if(!pipeline)
+                return;
 
             if(background.material.set.isCreated()){
-                background.material.set.bind(0, commandBuffer, pipeline.pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
+                background.material.set.bind(0, commandBuffer, pipeline->pipelineLayout, VK_PIPELINE_BIND_POINT_GRAPHICS, currentFrame);
             }
             vkCmdDraw(commandBuffer, 4, 1, 0, 0);
         }
@@ -149,4 +425,28 @@ namespace Vulgine{
     }
 
 
-}
\ No newline at end of file
+    bool SceneImpl::drawListChanged() {
+        bool changed = drawList.size() != drawListSnapshot.size();
+
+        if(!changed){
+            auto snapIt = drawListSnapshot.begin();
+            for(auto const& mesh: drawList){
+                auto meshPtr = mesh.lock();
+                if(!meshPtr || meshPtr.get() != *snapIt){
+                    changed = true;
+                    break;
+                }
+                ++snapIt;
+            }
+        }
+
+        if(changed){
+            drawListSnapshot.clear();
+            for(auto const& mesh: drawList)
+                drawListSnapshot.push_back(mesh.lock().get());
+        }
+
+        return changed;
+    }
+
+}
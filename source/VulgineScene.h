@@ -8,6 +8,7 @@
 #include <../include/IVulgineScene.h>
 #include <VulgineObjects.h>
 
+#include <tuple>
 #include <unordered_map>
 
 namespace Vulgine{
@@ -42,16 +43,54 @@ namespace Vulgine{
         std::unordered_map<uint32_t, SharedRef<LightImpl>> lights;
         std::unordered_map<uint32_t, SharedRef<CameraImpl>> cameras;
 
+        // draw list contents at the moment of last check
+
+        std::vector<Mesh*> drawListSnapshot;
+
+        /** Static meshes sharing geometry, vertex data, indices, materials and mesh descriptors, drawn by one
+         *  instanced draw of the first of them. Instance data of every mesh is concatenated into one region */
+
+        struct InstanceBatch{
+            std::vector<MeshImpl*> meshes;
+
+            // instance regions of meshes at the moment batch was built, it is built again once any of them changes
+
+            std::vector<std::tuple<uint32_t, VkBuffer, VkDeviceSize, VkDeviceSize>> sources;
+
+            Memory::BufferRegion instances;
+            uint32_t instanceCount = 0;
+        };
+
+        std::vector<InstanceBatch> instanceBatches;
+
         void createBackGround(const char* fragmentShaderModule, std::vector<std::pair<DescriptorInfo, Descriptor>> const& descriptors) override;
         void deleteBackGround() override;
         LightRef createLightSource() override;
         CameraRef createCamera() override;
 
         void update();
-        void draw(VkCommandBuffer commandBuffer, CameraImpl* camera, RenderPass* pass, int currentFrame);
+
+        /** returns true if draw list has changed since last call */
+        bool drawListChanged();
+
+        /** compiles draw list into packets drawing it in given pass, sorted to minimize state changes.
+         *  Expired meshes are removed from the list */
+        void compileDrawPackets(RenderPassImpl* pass, std::vector<DrawPacket>& packets);
+
+        /** records [first, last) range of packets. Doesn't touch the draw list, so it is safe to call from worker threads */
+        static void draw(VkCommandBuffer commandBuffer, CameraImpl* camera, std::vector<DrawPacket> const& packets, int currentFrame, size_t first, size_t last);
+
+        void removeExpiredMeshes();
+
+        /** groups instanceable meshes of draw list into batches, reusing instance regions of unchanged ones.
+         *  Returns batch index of each batched mesh */
+        std::unordered_map<MeshImpl*, size_t> compileInstanceBatches();
+
+        /** gives instance regions of batches back once frames using them are finished */
+        void releaseInstanceBatches();
 
         void drawBackground(VkCommandBuffer commandBuffer, CameraImpl* camera, RenderPass* pass, int currentFrame);
-        ~SceneImpl() override = default;
+        ~SceneImpl() override;
 
         void updateLight(uint32_t light);
 
@@ -0,0 +1,80 @@
+//
+// Created by Бушев Дмитрий on 02.08.2021.
+//
+
+#include "VulgineThreadPool.h"
+#include "VulgineCPUProfiler.h"
+
+namespace Vulgine{
+
+    void ThreadPool::start(uint32_t threadCount, std::string const& name) {
+        stop();
+
+        stopping = false;
+
+        for(uint32_t i = 0; i < threadCount; ++i)
+            workers.emplace_back(&ThreadPool::workerLoop, this, name + " #" + std::to_string(i));
+    }
+
+    void ThreadPool::stop() {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            stopping = true;
+        }
+
+        taskAvailable.notify_all();
+
+        for(auto& worker: workers)
+            worker.join();
+
+        workers.clear();
+    }
+
+    void ThreadPool::push(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            tasks.emplace_back(std::move(task));
+        }
+
+        taskAvailable.notify_one();
+    }
+
+    void ThreadPool::wait() {
+        std::unique_lock<std::mutex> lock{mutex};
+        allFinished.wait(lock, [this](){ return tasks.empty() && activeTasks == 0;});
+    }
+
+    void ThreadPool::workerLoop(std::string name) {
+        CPUProfiler::setThreadName(name);
+
+        for(;;){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock{mutex};
+                taskAvailable.wait(lock, [this](){ return stopping || !tasks.empty();});
+
+                // pending tasks are still executed on stop, so nobody waits forever
+
+                if(tasks.empty())
+                    return;
+
+                task = std::move(tasks.front());
+                tasks.pop_front();
+                activeTasks++;
+            }
+
+            task();
+
+            {
+                std::lock_guard<std::mutex> lock{mutex};
+                activeTasks--;
+                if(tasks.empty() && activeTasks == 0)
+                    allFinished.notify_all();
+            }
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        stop();
+    }
+}
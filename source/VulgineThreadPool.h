@@ -0,0 +1,54 @@
+//
+// Created by Бушев Дмитрий on 02.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINETHREADPOOL_H
+#define TEST_EXE_VULGINETHREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <string>
+
+namespace Vulgine{
+
+    /**
+     * Simple fixed-size pool of worker threads executing tasks in FIFO order.
+     *
+     * wait() blocks caller until every pushed task is finished, which is enough
+     * for fork-join style jobs like parallel command buffer recording.
+     * */
+
+    class ThreadPool{
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+
+        std::mutex mutex;
+        std::condition_variable taskAvailable;
+        std::condition_variable allFinished;
+
+        uint32_t activeTasks = 0;
+        bool stopping = false;
+
+        void workerLoop(std::string name);
+
+    public:
+
+        /** name is used to label worker threads in profiler */
+        void start(uint32_t threadCount, std::string const& name = "Worker");
+
+        void stop();
+
+        void push(std::function<void()> task);
+
+        void wait();
+
+        [[nodiscard]] uint32_t size() const { return workers.size();};
+
+        ~ThreadPool();
+    };
+}
+#endif //TEST_EXE_VULGINETHREADPOOL_H
@@ -0,0 +1,130 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#include "VulgineTimeline.h"
+#include "Utilities.h"
+#include "VulgineCPUProfiler.h"
+#include <vector>
+
+namespace Vulgine{
+
+    namespace {
+
+        // other threads may observe GPU progress concurrently, so known value only grows
+
+        void raise(std::atomic<uint64_t>& known, uint64_t value){
+            uint64_t current = known.load();
+            while(current < value && !known.compare_exchange_weak(current, value));
+        }
+    }
+
+    void Timeline::create(VkDevice logicalDevice) {
+        device = logicalDevice;
+
+        VkSemaphoreTypeCreateInfo typeCI{};
+        typeCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeCI.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeCI.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreCI{};
+        semaphoreCI.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreCI.pNext = &typeCI;
+
+        VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreCI, nullptr, &semaphore))
+
+        pendingValue = 0;
+        completedValue = 0;
+        lastQueue = VK_NULL_HANDLE;
+    }
+
+    void Timeline::destroy() {
+        vkDestroySemaphore(device, semaphore, nullptr);
+        semaphore = VK_NULL_HANDLE;
+    }
+
+    uint64_t Timeline::submit(VkQueue queue, VkSubmitInfo submitInfo, Timeline* dependency, uint64_t dependencyValue) {
+        std::lock_guard<std::mutex> lock{submitMutex};
+
+        uint64_t value = pendingValue + 1;
+
+        // values of binary semaphores are ignored
+
+        std::vector<VkSemaphore> waitSemaphores(submitInfo.pWaitSemaphores, submitInfo.pWaitSemaphores + submitInfo.waitSemaphoreCount);
+        std::vector<VkPipelineStageFlags> waitStages(submitInfo.pWaitDstStageMask, submitInfo.pWaitDstStageMask + submitInfo.waitSemaphoreCount);
+        std::vector<uint64_t> waitValues(submitInfo.waitSemaphoreCount, 0);
+
+        // Signals must happen in increasing order. Different queues run independently, so batch sent to
+        // another queue than the previous one must not finish before the previous one
+
+        if(lastQueue != VK_NULL_HANDLE && lastQueue != queue){
+            waitSemaphores.push_back(semaphore);
+            waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            waitValues.push_back(value - 1);
+        }
+
+        if(dependency){
+            waitSemaphores.push_back(dependency->semaphore);
+            waitStages.push_back(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+            waitValues.push_back(dependencyValue);
+        }
+
+        std::vector<VkSemaphore> signalSemaphores(submitInfo.pSignalSemaphores, submitInfo.pSignalSemaphores + submitInfo.signalSemaphoreCount);
+        std::vector<uint64_t> signalValues(submitInfo.signalSemaphoreCount, 0);
+
+        signalSemaphores.push_back(semaphore);
+        signalValues.push_back(value);
+
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.pNext = submitInfo.pNext;
+        timelineInfo.waitSemaphoreValueCount = waitValues.size();
+        timelineInfo.pWaitSemaphoreValues = waitValues.data();
+        timelineInfo.signalSemaphoreValueCount = signalValues.size();
+        timelineInfo.pSignalSemaphoreValues = signalValues.data();
+
+        submitInfo.pNext = &timelineInfo;
+        submitInfo.waitSemaphoreCount = waitSemaphores.size();
+        submitInfo.pWaitSemaphores = waitSemaphores.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+        submitInfo.signalSemaphoreCount = signalSemaphores.size();
+        submitInfo.pSignalSemaphores = signalSemaphores.data();
+
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE))
+
+        lastQueue = queue;
+        pendingValue = value;
+
+        return value;
+    }
+
+    uint64_t Timeline::completed() {
+        uint64_t value;
+        VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device, semaphore, &value))
+
+        raise(completedValue, value);
+
+        return value;
+    }
+
+    bool Timeline::reached(uint64_t value) {
+        return completedValue.load() >= value || completed() >= value;
+    }
+
+    void Timeline::wait(uint64_t value) {
+        if(completedValue.load() >= value)
+            return;
+
+        VULGINE_PROFILE_ZONE("wait GPU timeline");
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &semaphore;
+        waitInfo.pValues = &value;
+
+        VK_CHECK_RESULT(vkWaitSemaphores(device, &waitInfo, UINT64_MAX))
+
+        raise(completedValue, value);
+    }
+}
@@ -0,0 +1,64 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINETIMELINE_H
+#define TEST_EXE_VULGINETIMELINE_H
+
+#include "vulkan/vulkan.h"
+#include <atomic>
+#include <mutex>
+
+namespace Vulgine{
+
+    /**
+     * GPU progress clock built on a single timeline semaphore.
+     *
+     * Every engine submission goes through submit(), which signals the next value of the timeline, so
+     * "GPU finished submission N" is the same as "timeline reached N" and covers every earlier
+     * submission as well. Frames in flight, retired objects and uploads all wait for such values
+     * instead of per-frame fences or idle queues.
+     *
+     * submit() also serializes access to queues, so queues used with it must not be submitted to directly.
+     * */
+
+    class Timeline{
+        VkDevice device = VK_NULL_HANDLE;
+        VkSemaphore semaphore = VK_NULL_HANDLE;
+
+        std::mutex submitMutex;
+        VkQueue lastQueue = VK_NULL_HANDLE;
+
+        // last value handed out by submit()
+
+        std::atomic<uint64_t> pendingValue = 0;
+
+        // last value known to be reached by GPU
+
+        std::atomic<uint64_t> completedValue = 0;
+
+    public:
+
+        void create(VkDevice logicalDevice);
+        void destroy();
+
+        /** submits batch, additionally signaling next value of the timeline. Returns this value.
+         *  If dependency is given, batch also waits until it reaches dependencyValue */
+        uint64_t submit(VkQueue queue, VkSubmitInfo submitInfo, Timeline* dependency = nullptr, uint64_t dependencyValue = 0);
+
+        /** value signaled by the latest submission */
+        uint64_t pending() const { return pendingValue.load();};
+
+        /** queries value reached by GPU */
+        uint64_t completed();
+
+        bool reached(uint64_t value);
+
+        /** blocks until GPU reaches value */
+        void wait(uint64_t value);
+
+        /** blocks until every submission made so far is finished */
+        void waitIdle() { wait(pending());};
+    };
+}
+#endif //TEST_EXE_VULGINETIMELINE_H
@@ -4,8 +4,15 @@
 
 #include "VulgineUI.h"
 #include "Vulgine.h"
+#include <cstring>
+#include <string_view>
+#include <algorithm>
 namespace {
     ImVec2 mainMenuBarSize;
+
+    float toMiB(uint64_t bytes){
+        return static_cast<float>(bytes) / (1024.0f * 1024.0f);
+    }
 }
 namespace Vulgine {
 
@@ -29,6 +36,9 @@ namespace Vulgine {
         if (metricsViewerOpened)
             drawMetricsViewerWindow();
 
+        if (cpuTimelineOpened)
+            drawCPUTimelineWindow();
+
         if(logOpened)
             drawLogWindow();
 
@@ -45,6 +55,9 @@ namespace Vulgine {
                 if (ImGui::MenuItem("System Properties", "CTRL+Y", systemPropertiesOpened)) {
                     systemPropertiesOpened = true;
                 }
+                if (ImGui::MenuItem("CPU Timeline", "", cpuTimelineOpened)) {
+                    cpuTimelineOpened = true;
+                }
                 ImGui::Separator();
                 if (ImGui::MenuItem("Show about", "F1")) {
                     aboutOpened = true;
@@ -54,7 +67,9 @@ namespace Vulgine {
                 }
                 ImGui::Separator();
                 if (ImGui::MenuItem("Quit", "Alt + F4")) {
+#ifndef VULGINE_NO_WINDOW
                     glfwSetWindowShouldClose(vlg.window.instance(), GLFW_TRUE);
+#endif
                 }
                 ImGui::EndMenu();
             }
@@ -78,6 +93,18 @@ namespace Vulgine {
                 if(ImGui::MenuItem("vsync", "", vlg.settings.vsync)){
                     vlg.toggleVsync();
                 }
+                if(ImGui::MenuItem("reuse command buffers", "", vlg.settings.reuseCommandBuffers)){
+                    vlg.settings.reuseCommandBuffers = !vlg.settings.reuseCommandBuffers;
+                    vlg.cmdBuffersOutdated = true;
+                }
+                if(ImGui::MenuItem("automatic instancing", "", vlg.settings.autoInstancing)){
+                    vlg.settings.autoInstancing = !vlg.settings.autoInstancing;
+                    vlg.cmdBuffersOutdated = true;
+                }
+                if(ImGui::MenuItem("indirect draws", "", vlg.settings.indirectDraws)){
+                    vlg.settings.indirectDraws = !vlg.settings.indirectDraws;
+                    vlg.cmdBuffersOutdated = true;
+                }
                 if(ImGui::MenuItem("fullscreen", "", vlg.window.fullscreen)){
                     if(!vlg.window.fullscreen)
                         vlg.window.goFullscreen();
@@ -99,11 +126,165 @@ namespace Vulgine {
             ImGui::Separator();
             ImGui::BulletText("Meshes: %d", ObjectImpl::count(Object::Type::MESH));
             ImGui::BulletText("Images: %d", ObjectImpl::count(Object::Type::IMAGE));
+            ImGui::Separator();
+            ImGui::BulletText("Binds recorded: %u (%u redundant elided)", vlg.recordedBinds.load(), vlg.elidedBinds.load());
+            ImGui::Separator();
+
+            if (ImGui::CollapsingHeader("Memory")) {
+                auto stats = vlg.memoryStatistics();
+
+                ImGui::Text("Heaps (%s):", stats.driverBudget ? "driver budget" : "estimated budget");
+                for (size_t i = 0; i < stats.heaps.size(); ++i) {
+                    auto const &heap = stats.heaps.at(i);
+                    ImGui::BulletText("Heap %d%s: %.1f / %.1f MiB used, %.1f MiB allocated (%.1f MiB in use)", (int) i,
+                                      heap.deviceLocal ? " (device local)" : "", toMiB(heap.usage), toMiB(heap.budget),
+                                      toMiB(heap.blockBytes), toMiB(heap.allocationBytes));
+                }
+
+                ImGui::Text("Objects:");
+                ImGui::BulletText("Meshes: %.2f MiB", toMiB(stats.meshBytes));
+                ImGui::BulletText("Geometry pools: %.2f MiB", toMiB(stats.geometryPoolBytes));
+                ImGui::BulletText("Images: %.2f MiB", toMiB(stats.imageBytes));
+                ImGui::BulletText("Uniform buffers: %.2f MiB", toMiB(stats.uniformBufferBytes));
+                ImGui::BulletText("Attachments: %.2f MiB", toMiB(stats.attachmentBytes));
+                ImGui::BulletText("Staging: %.2f MiB", toMiB(stats.stagingBytes));
+
+                if (ImGui::Button("Export memory statistics"))
+                    vlg.exportMemoryStatistics("memory_stats.json");
+                ImGui::SameLine();
+                if (vlg.defragmenter.active())
+                    ImGui::Text("Defragmenting...");
+                else if (ImGui::Button("Defragment"))
+                    vlg.defragmentMemory();
+            }
+            ImGui::Separator();
+
+            // toggling profiler changes recorded commands
+
+            if(ImGui::Checkbox("GPU profiler", &vlg.gpuProfiler.enabled))
+                vlg.cmdBuffersOutdated = true;
+
+            if(vlg.gpuProfiler.active()) {
+                auto const* frame = vlg.gpuProfiler.lastFrame();
+                if (frame) {
+                    ImGui::Text("GPU frame %llu:", static_cast<unsigned long long>(frame->frame));
+                    for (auto const &zone: frame->zones) {
+                        ImGui::Indent(10.0f * (zone.depth + 1));
+                        ImGui::Text("%s: %.3fms", zone.name.c_str(), zone.duration);
+                        ImGui::Unindent(10.0f * (zone.depth + 1));
+                    }
+                }
+                if (ImGui::Button("Export GPU trace"))
+                    vlg.exportGPUTrace("gpu_trace.json");
+            }
         }
 
         ImGui::End();
     }
 
+    void UserInterface::drawCPUTimelineWindow() {
+        if (ImGui::Begin("CPU Timeline", &cpuTimelineOpened)) {
+#ifdef VULGINE_CPU_PROFILER
+            bool enabled = CPUProfiler::enabled;
+            if (ImGui::Checkbox("Record", &enabled))
+                CPUProfiler::enabled = enabled;
+            ImGui::SameLine();
+            ImGui::Checkbox("Pause", &cpuTimelinePaused);
+            ImGui::SameLine();
+            if (ImGui::Button("Export trace"))
+                GetImpl().exportCPUTrace("cpu_trace.json");
+
+            if (!cpuTimelinePaused)
+                captureCPUTimeline();
+
+            drawCPUTimeline();
+#else
+            ImGui::Text("CPU profiler zones are compiled out (see VULGINE_CPU_PROFILER option)");
+#endif
+        }
+
+        ImGui::End();
+    }
+
+    void UserInterface::captureCPUTimeline() {
+
+        // timeline shows last finished frame. Current one is still being recorded, as we are inside of it
+
+        uint64_t now = CPUProfiler::now();
+        cpuTimeline = CPUProfiler::snapshot(now - 200000000ull);
+
+        cpuTimelineBegin = now - 20000000ull;
+        cpuTimelineEnd = now;
+
+        for (auto const &thread: cpuTimeline)
+            for (auto it = thread.events.rbegin(); it != thread.events.rend(); ++it)
+                if (strcmp(it->name, "cycle") == 0) {
+                    cpuTimelineBegin = it->start;
+                    cpuTimelineEnd = it->end;
+                    return;
+                }
+    }
+
+    void UserInterface::drawCPUTimeline() {
+        if (cpuTimelineEnd <= cpuTimelineBegin)
+            return;
+
+        double span = static_cast<double>(cpuTimelineEnd - cpuTimelineBegin);
+        ImGui::Text("Frame: %.3fms", span / 1000000.0);
+        ImGui::Separator();
+
+        float width = ImGui::GetContentRegionAvail().x;
+        float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+        auto *drawList = ImGui::GetWindowDrawList();
+        auto mouse = ImGui::GetIO().MousePos;
+
+        auto overlaps = [this](CPUProfiler::Event const &event) {
+            return event.end > cpuTimelineBegin && event.start < cpuTimelineEnd;
+        };
+
+        for (auto const &thread: cpuTimeline) {
+            uint32_t depth = 0;
+            bool any = false;
+            for (auto const &event: thread.events)
+                if (overlaps(event)) {
+                    any = true;
+                    depth = std::max(depth, event.depth + 1);
+                }
+
+            if (!any)
+                continue;
+
+            ImGui::TextUnformatted(thread.name.c_str());
+
+            ImVec2 origin = ImGui::GetCursorScreenPos();
+            ImGui::InvisibleButton(("##cpu_thread_" + std::to_string(thread.thread)).c_str(), ImVec2(width, rowHeight * depth));
+            bool hovered = ImGui::IsItemHovered();
+
+            for (auto const &event: thread.events) {
+                if (!overlaps(event))
+                    continue;
+
+                float x0 = origin.x + width * static_cast<float>(static_cast<double>(std::max(event.start, cpuTimelineBegin) - cpuTimelineBegin) / span);
+                float x1 = origin.x + width * static_cast<float>(static_cast<double>(std::min(event.end, cpuTimelineEnd) - cpuTimelineBegin) / span);
+                x1 = std::max(x1, x0 + 1.0f);
+                float y0 = origin.y + rowHeight * event.depth;
+                float y1 = y0 + rowHeight - 1.0f;
+
+                // stable color per zone name
+
+                float hue = static_cast<float>(std::hash<std::string_view>{}(event.name) % 360) / 360.0f;
+                drawList->AddRectFilled(ImVec2(x0, y0), ImVec2(x1, y1), ImColor::HSV(hue, 0.5f, 0.6f));
+
+                drawList->PushClipRect(ImVec2(x0, y0), ImVec2(x1, y1), true);
+                drawList->AddText(ImVec2(x0 + 2.0f, y0), IM_COL32_WHITE, event.name);
+                drawList->PopClipRect();
+
+                if (hovered && mouse.x >= x0 && mouse.x < x1 && mouse.y >= y0 && mouse.y < y1)
+                    ImGui::SetTooltip("%s: %.3fms", event.name, static_cast<double>(event.end - event.start) / 1000000.0);
+            }
+        }
+    }
+
     void UserInterface::drawSystemPropertiesWindow() {
         auto &vlg = GetImpl();
         if (ImGui::Begin("System properties", &systemPropertiesOpened)) {
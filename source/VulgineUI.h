@@ -7,6 +7,7 @@
 
 #include "imgui/imgui.h"
 #include "IVulgineObjects.h"
+#include "VulgineCPUProfiler.h"
 #include <vector>
 
 namespace Vulgine{
@@ -79,10 +80,23 @@ namespace Vulgine{
         bool systemPropertiesOpened = false;
         bool logOpened = false;
         bool aboutOpened = false;
+        bool cpuTimelineOpened = false;
+
+        // zones of last frame shown by CPU timeline, kept while timeline is paused
+
+        std::vector<CPUProfiler::ThreadEvents> cpuTimeline;
+        uint64_t cpuTimelineBegin = 0;
+        uint64_t cpuTimelineEnd = 0;
+        bool cpuTimelinePaused = false;
+
+        void captureCPUTimeline();
+        void drawCPUTimeline();
+
         void drawLogWindow();
         void drawMetricsViewerWindow();
         void drawSystemPropertiesWindow();
         void drawAboutWindow();
+        void drawCPUTimelineWindow();
         void draw();
 
         ~UserInterface();
@@ -0,0 +1,453 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#include "VulgineUploader.h"
+#include "Vulgine.h"
+#include "Utilities.h"
+#include "vulkan/VulkanInitializers.hpp"
+#include <algorithm>
+
+namespace Vulgine{
+
+    namespace {
+
+        // stages and accesses buffer is read with by draws
+
+        void consumerOf(VkBufferUsageFlags usage, VkPipelineStageFlags& stages, VkAccessFlags& access){
+            stages = 0;
+            access = 0;
+
+            if(usage & VK_BUFFER_USAGE_VERTEX_BUFFER_BIT){
+                stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+                access |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+            }
+            if(usage & VK_BUFFER_USAGE_INDEX_BUFFER_BIT){
+                stages |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+                access |= VK_ACCESS_INDEX_READ_BIT;
+            }
+            if(usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT){
+                stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+                access |= VK_ACCESS_UNIFORM_READ_BIT;
+            }
+            if(usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT){
+                stages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+                access |= VK_ACCESS_SHADER_READ_BIT;
+            }
+            if(usage & VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT){
+                stages |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+                access |= VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+            }
+
+            if(stages == 0){
+                stages = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+                access = VK_ACCESS_MEMORY_READ_BIT;
+            }
+        }
+    }
+
+    void Uploader::create(VkDevice logicalDevice, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize) {
+        device = logicalDevice;
+        transferFamily = transferQueueFamily;
+        graphicsFamily = graphicsQueueFamily;
+
+        VkCommandPoolCreateInfo poolCI{};
+        poolCI.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolCI.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolCI.queueFamilyIndex = transferFamily;
+
+        VK_CHECK_RESULT(vkCreateCommandPool(device, &poolCI, nullptr, &transferPool))
+
+        if(ownershipTransfer()){
+            poolCI.queueFamilyIndex = graphicsFamily;
+            VK_CHECK_RESULT(vkCreateCommandPool(device, &poolCI, nullptr, &acquirePool))
+
+            transferTimeline.create(device);
+        }
+
+        // offsets of buffer to image copies must be multiple of texel size and 4
+
+        auto alignment = std::max<VkDeviceSize>(16, GetImpl().device->properties.limits.optimalBufferCopyOffsetAlignment);
+
+        ring.create(stagingSize, alignment);
+
+        logger(ownershipTransfer() ? "Uploads go to dedicated transfer queue family " + std::to_string(transferFamily)
+                                   : std::string("Uploads share queue family with graphics"));
+    }
+
+    void Uploader::destroy() {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        // GPU is idle by now, so batch still being recorded is just thrown away
+
+        if(recording){
+            vkFreeCommandBuffers(device, transferPool, 1, &recording->transferCmd);
+            recording.reset();
+        }
+
+        for(auto& submitted: inFlight){
+            vkFreeCommandBuffers(device, transferPool, 1, &submitted->transferCmd);
+            if(submitted->acquireCmd != VK_NULL_HANDLE)
+                vkFreeCommandBuffers(device, acquirePool, 1, &submitted->acquireCmd);
+        }
+
+        inFlight.clear();
+
+        ring.free();
+
+        vkDestroyCommandPool(device, transferPool, nullptr);
+        transferPool = VK_NULL_HANDLE;
+
+        if(acquirePool != VK_NULL_HANDLE){
+            vkDestroyCommandPool(device, acquirePool, nullptr);
+            acquirePool = VK_NULL_HANDLE;
+
+            transferTimeline.destroy();
+        }
+    }
+
+    Uploader::Batch &Uploader::batch() {
+        if(recording)
+            return *recording;
+
+        recording = std::make_unique<Batch>();
+        recording->id = nextBatch++;
+
+        VkCommandBufferAllocateInfo allocInfo = initializers::commandBufferAllocateInfo(transferPool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &recording->transferCmd))
+
+        VkCommandBufferBeginInfo beginInfo = initializers::commandBufferBeginInfo();
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(recording->transferCmd, &beginInfo))
+
+        return *recording;
+    }
+
+    Uploader::StagingRegion Uploader::stage(const void *data, VkDeviceSize size) {
+
+        // large upload would make ring wait for every batch before it
+
+        if(size > ring.size() / 4){
+            auto& staging = batch().staging.emplace_back(std::make_unique<Memory::StagingBuffer>());
+
+            staging->create(size);
+            staging->fill(data);
+
+            return {staging->buffer, 0};
+        }
+
+        VkDeviceSize offset;
+
+        while(!ring.push(data, size, offset)){
+
+            // rest of the ring is taken by batch being recorded
+
+            if(inFlight.empty())
+                flushLocked();
+
+            assert(!inFlight.empty() && "Staging ring is full with no uploads pending");
+
+            auto value = inFlight.front()->value;
+
+            GetImpl().timeline.wait(value);
+            collectLocked(value);
+        }
+
+        return {ring.buffer, offset};
+    }
+
+    UploadToken Uploader::upload(Memory::Buffer &buffer, VkBufferUsageFlags usage, const void *data, VkDeviceSize size, VkDeviceSize offset) {
+        assert(data && size && buffer.allocated && "Invalid upload description");
+
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto staging = stage(data, size);
+
+        auto& current = batch();
+
+        VkBufferCopy region{};
+        region.srcOffset = staging.offset;
+        region.dstOffset = offset;
+        region.size = size;
+
+        vkCmdCopyBuffer(current.transferCmd, staging.buffer, buffer.buffer, 1, &region);
+
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        consumerOf(usage, stages, access);
+
+        current.dstStages |= stages;
+        current.dstAccess |= access;
+
+        if(ownershipTransfer()){
+            VkBufferMemoryBarrier barrier = initializers::bufferMemoryBarrier();
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = access;
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+            barrier.buffer = buffer.buffer;
+            barrier.offset = offset;
+            barrier.size = size;
+
+            current.bufferBarriers.push_back(barrier);
+        }
+
+        return {current.id};
+    }
+
+    UploadToken Uploader::upload(Memory::Image &image, const void *data, VkDeviceSize size) {
+        assert(data && size && image.allocated && "Invalid upload description");
+
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto staging = stage(data, size);
+
+        auto& current = batch();
+
+        VkImageMemoryBarrier barrier = initializers::imageMemoryBarrier();
+        barrier.image = image.image;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+        // previous contents are discarded, so image may be taken by transfer family without ownership transfer
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(current.transferCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = staging.offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageExtent = image.imageInfo.extent;
+
+        vkCmdCopyBufferToImage(current.transferCmd, staging.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        if(ownershipTransfer()){
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+        }
+
+        current.imageBarriers.push_back(barrier);
+        current.dstStages |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        current.dstAccess |= VK_ACCESS_SHADER_READ_BIT;
+
+        return {current.id};
+    }
+
+    UploadToken Uploader::copy(Memory::Buffer &src, VkDeviceSize srcOffset, Memory::Buffer &dst, VkDeviceSize dstOffset,
+                               VkDeviceSize size, VkBufferUsageFlags usage) {
+        assert(size && src.allocated && dst.allocated && "Invalid copy description");
+
+        std::lock_guard<std::mutex> lock{mutex};
+
+        auto& current = batch();
+
+        VkBufferCopy region{};
+        region.srcOffset = srcOffset;
+        region.dstOffset = dstOffset;
+        region.size = size;
+
+        current.deviceCopies.push_back({src.buffer, dst.buffer, region});
+
+        VkPipelineStageFlags stages;
+        VkAccessFlags access;
+        consumerOf(usage, stages, access);
+
+        current.dstStages |= stages;
+        current.dstAccess |= access;
+
+        return {current.id};
+    }
+
+    void Uploader::recordDeviceCopies(VkCommandBuffer commandBuffer, Uploader::Batch &batch) {
+        if(batch.deviceCopies.empty())
+            return;
+
+        // sources may be written by earlier uploads and frames, or by uploads of this batch
+
+        VkMemoryBarrier barrier = initializers::memoryBarrier();
+        barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+
+        for(auto const& copy: batch.deviceCopies)
+            vkCmdCopyBuffer(commandBuffer, copy.src, copy.dst, 1, &copy.region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = batch.dstAccess;
+
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, batch.dstStages, 0,
+                             1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    void Uploader::recordBarriers(Uploader::Batch &batch) {
+        if(!ownershipTransfer()){
+
+            // buffers are covered by single global barrier, images still need their layouts changed
+
+            VkMemoryBarrier memoryBarrier = initializers::memoryBarrier();
+            memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            memoryBarrier.dstAccessMask = batch.dstAccess;
+
+            vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, batch.dstStages, 0,
+                                 1, &memoryBarrier, 0, nullptr,
+                                 batch.imageBarriers.size(), batch.imageBarriers.data());
+
+            // transfer queue is the graphics one
+
+            recordDeviceCopies(batch.transferCmd, batch);
+            return;
+        }
+
+        // Release: transfer queue makes writes available, dst masks are ignored by it
+
+        auto bufferBarriers = batch.bufferBarriers;
+        auto imageBarriers = batch.imageBarriers;
+
+        for(auto& barrier: bufferBarriers)
+            barrier.dstAccessMask = 0;
+        for(auto& barrier: imageBarriers)
+            barrier.dstAccessMask = 0;
+
+        vkCmdPipelineBarrier(batch.transferCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                             0, nullptr, bufferBarriers.size(), bufferBarriers.data(),
+                             imageBarriers.size(), imageBarriers.data());
+
+        // Acquire: graphics queue makes them visible to consumers once copies are done
+
+        VkCommandBufferAllocateInfo allocInfo = initializers::commandBufferAllocateInfo(acquirePool, VK_COMMAND_BUFFER_LEVEL_PRIMARY, 1);
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &batch.acquireCmd))
+
+        VkCommandBufferBeginInfo beginInfo = initializers::commandBufferBeginInfo();
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(batch.acquireCmd, &beginInfo))
+
+        for(auto& barrier: batch.bufferBarriers)
+            barrier.srcAccessMask = 0;
+        for(auto& barrier: batch.imageBarriers)
+            barrier.srcAccessMask = 0;
+
+        vkCmdPipelineBarrier(batch.acquireCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, batch.dstStages, 0,
+                             0, nullptr, batch.bufferBarriers.size(), batch.bufferBarriers.data(),
+                             batch.imageBarriers.size(), batch.imageBarriers.data());
+
+        recordDeviceCopies(batch.acquireCmd, batch);
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(batch.acquireCmd))
+    }
+
+    void Uploader::flushLocked() {
+        if(!recording)
+            return;
+
+        VULGINE_PROFILE_ZONE("flush uploads");
+
+        auto& vlg = GetImpl();
+
+        recordBarriers(*recording);
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(recording->transferCmd))
+
+        recording->ringEnd = ring.position();
+
+        VkSubmitInfo submitInfo = initializers::submitInfo();
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &recording->transferCmd;
+
+        if(ownershipTransfer()){
+            uint64_t copied = transferTimeline.submit(vlg.transferQueue, submitInfo);
+
+            submitInfo.pCommandBuffers = &recording->acquireCmd;
+            recording->value = vlg.timeline.submit(vlg.queue, submitInfo, &transferTimeline, copied);
+        } else {
+
+            // transfer queue is the graphics one
+
+            recording->value = vlg.timeline.submit(vlg.transferQueue, submitInfo);
+        }
+
+        inFlight.push_back(std::move(recording));
+    }
+
+    void Uploader::flush() {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        flushLocked();
+    }
+
+    bool Uploader::done(UploadToken token) {
+        uint64_t value;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+
+            if(recording && recording->id == token.batch)
+                return false;
+
+            auto submitted = std::find_if(inFlight.begin(), inFlight.end(), [token](std::unique_ptr<Batch> const& batch){
+                return batch->id == token.batch;
+            });
+
+            // batches are collected only after they are done
+
+            if(submitted == inFlight.end())
+                return true;
+
+            value = (*submitted)->value;
+        }
+
+        return GetImpl().timeline.reached(value);
+    }
+
+    void Uploader::wait(UploadToken token) {
+        uint64_t value;
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+
+            if(recording && recording->id == token.batch)
+                flushLocked();
+
+            auto submitted = std::find_if(inFlight.begin(), inFlight.end(), [token](std::unique_ptr<Batch> const& batch){
+                return batch->id == token.batch;
+            });
+
+            if(submitted == inFlight.end())
+                return;
+
+            value = (*submitted)->value;
+        }
+
+        GetImpl().timeline.wait(value);
+    }
+
+    void Uploader::collect(uint64_t completedValue) {
+        std::lock_guard<std::mutex> lock{mutex};
+
+        collectLocked(completedValue);
+    }
+
+    void Uploader::collectLocked(uint64_t completedValue) {
+        while(!inFlight.empty() && inFlight.front()->value <= completedValue){
+            auto& batch = inFlight.front();
+
+            ring.release(batch->ringEnd);
+
+            vkFreeCommandBuffers(device, transferPool, 1, &batch->transferCmd);
+            if(batch->acquireCmd != VK_NULL_HANDLE)
+                vkFreeCommandBuffers(device, acquirePool, 1, &batch->acquireCmd);
+
+            inFlight.pop_front();
+        }
+    }
+}
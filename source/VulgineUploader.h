@@ -0,0 +1,158 @@
+//
+// Created by Бушев Дмитрий on 05.08.2021.
+//
+
+#ifndef TEST_EXE_VULGINEUPLOADER_H
+#define TEST_EXE_VULGINEUPLOADER_H
+
+#include "vulkan/vulkan.h"
+#include "vulkan/VulkanAllocatable.h"
+#include "VulgineTimeline.h"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace Vulgine{
+
+    /** identifies batch upload was put in. Default constructed token is complete */
+
+    struct UploadToken{
+        uint64_t batch = 0;
+    };
+
+    /**
+     * Copies data from host to device local buffers and images without blocking the caller.
+     *
+     * Uploads are recorded into one batch, which is submitted to the transfer queue as a whole by flush()
+     * (at latest, right before the next frame is submitted). If the transfer queue belongs to another family
+     * than the graphics one, every resource is released by the transfer queue and acquired by the graphics
+     * queue in a separate submission. Transfer queue has its own timeline then, so copies don't have to wait
+     * for frames rendered meanwhile, only the acquire submission waits for them.
+     *
+     * Data is staged in persistently mapped ring, regions of a batch are reclaimed once the engine timeline
+     * reaches its value. If ring is full, upload waits for the oldest batch. Uploads too large for the ring
+     * get dedicated staging buffer kept along with the batch.
+     *
+     * Copies between device buffers are executed by the graphics queue after the uploads of their batch, so
+     * they may read data uploaded by it.
+     * */
+
+    class Uploader{
+
+        struct Batch{
+            uint64_t id = 0;
+            uint64_t value = 0;     // timeline value signaled once whole batch is done
+
+            VkCommandBuffer transferCmd = VK_NULL_HANDLE;
+            VkCommandBuffer acquireCmd = VK_NULL_HANDLE;
+
+            // staging for oversized uploads
+
+            std::vector<std::unique_ptr<Memory::StagingBuffer>> staging;
+
+            // ring position after the last region of the batch
+
+            uint64_t ringEnd = 0;
+
+            // Barriers making uploaded data visible to consumers, recorded once per batch. Their dst access
+            // masks are the ones of consumers, even if they are used for queue family release.
+
+            std::vector<VkBufferMemoryBarrier> bufferBarriers;
+            std::vector<VkImageMemoryBarrier> imageBarriers;
+            VkPipelineStageFlags dstStages = 0;
+            VkAccessFlags dstAccess = 0;
+
+            // Copies between device buffers. Their sources are owned by graphics queue family, so they are
+            // recorded by its command buffer after uploads of the batch
+
+            struct DeviceCopy{
+                VkBuffer src;
+                VkBuffer dst;
+                VkBufferCopy region;
+            };
+
+            std::vector<DeviceCopy> deviceCopies;
+        };
+
+        VkDevice device = VK_NULL_HANDLE;
+
+        uint32_t transferFamily = 0;
+        uint32_t graphicsFamily = 0;
+
+        VkCommandPool transferPool = VK_NULL_HANDLE;
+        VkCommandPool acquirePool = VK_NULL_HANDLE;
+
+        // progress of transfer queue, used only if it belongs to its own family
+
+        Timeline transferTimeline;
+
+        Memory::StagingRing ring;
+
+        struct StagingRegion{
+            VkBuffer buffer;
+            VkDeviceSize offset;
+        };
+
+        // uploads may be requested by any thread
+
+        std::mutex mutex;
+
+        // batch being recorded, it's opened by the first upload after flush
+
+        std::unique_ptr<Batch> recording;
+
+        // submitted batches in submission order, so their values grow
+
+        std::deque<std::unique_ptr<Batch>> inFlight;
+
+        uint64_t nextBatch = 1;
+
+        bool ownershipTransfer() const { return transferFamily != graphicsFamily;};
+
+        Batch& batch();
+
+        void flushLocked();
+
+        void collectLocked(uint64_t completedValue);
+
+        /** copies data to staging memory. May submit recorded batch and wait for ring space */
+        StagingRegion stage(const void* data, VkDeviceSize size);
+
+        /** records barriers of the batch: queue family release and acquire, or plain barrier if family is shared */
+        void recordBarriers(Batch& batch);
+
+        /** records device copies of the batch into graphics family command buffer, after data they read is visible */
+        static void recordDeviceCopies(VkCommandBuffer commandBuffer, Batch& batch);
+
+    public:
+
+        void create(VkDevice logicalDevice, uint32_t transferQueueFamily, uint32_t graphicsQueueFamily, VkDeviceSize stagingSize);
+        void destroy();
+
+        /** copies size bytes of data to buffer at offset. Consumers of the buffer are deduced from its usage */
+        UploadToken upload(Memory::Buffer& buffer, VkBufferUsageFlags usage, const void* data, VkDeviceSize size, VkDeviceSize offset = 0);
+
+        /** fills whole mip 0 of color image with tightly packed data and leaves it in layout ready for sampling */
+        UploadToken upload(Memory::Image& image, const void* data, VkDeviceSize size);
+
+        /** copies size bytes between device buffers, after uploads recorded so far. Source must be used by
+         *  graphics queue family only. Consumers of the destination are deduced from its usage */
+        UploadToken copy(Memory::Buffer& src, VkDeviceSize srcOffset, Memory::Buffer& dst, VkDeviceSize dstOffset,
+                         VkDeviceSize size, VkBufferUsageFlags usage);
+
+        /** submits recorded batch if any */
+        void flush();
+
+        bool done(UploadToken token);
+
+        /** blocks until uploads of the token are executed, submitting them if needed */
+        void wait(UploadToken token);
+
+        /** releases resources of batches executed by the time timeline reached completedValue */
+        void collect(uint64_t completedValue);
+
+        VkDeviceSize stagingSize() const { return ring.size();};
+    };
+}
+#endif //TEST_EXE_VULGINEUPLOADER_H
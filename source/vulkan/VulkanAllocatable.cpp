@@ -5,6 +5,7 @@
 #include "VulkanAllocatable.h"
 #include "Vulgine.h"
 #include "VulkanInitializers.hpp"
+#include <algorithm>
 
 
 
@@ -13,6 +14,7 @@ void Vulgine::Memory::Buffer::allocate(VkBufferCreateInfo bufferCI, VmaMemoryUsa
         vmaDestroyBuffer(GetImpl().allocator, buffer, allocation);
     }
 
+    bufferInfo = bufferCI;
     VmaAllocationCreateInfo allocInfo = {};
     allocInfo.usage = memoryUsageFlags;
     allocInfo.preferredFlags = prefFlags;
@@ -25,6 +27,16 @@ void Vulgine::Memory::Buffer::allocate(VkBufferCreateInfo bufferCI, VmaMemoryUsa
     allocated = true;
 }
 
+VkDeviceSize Vulgine::Memory::Allocatable::allocationSize() const {
+    if(!allocated)
+        return 0;
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(GetImpl().allocator, allocation, &info);
+
+    return info.size;
+}
+
 Vulgine::Memory::Buffer::~Buffer() {
     if(allocated){
         vmaDestroyBuffer(GetImpl().allocator, buffer, allocation);
@@ -41,7 +53,7 @@ void Vulgine::Memory::Buffer::free() {
 }
 
 void Vulgine::Memory::Image::allocate(VkImageCreateInfo imageCI, VmaMemoryUsage memoryUsageFlags, VmaAllocationCreateFlags allocFlags, VkMemoryPropertyFlags reqFlags, VkMemoryPropertyFlags prefFlags) {
-    if(allocated){
+    if(allocated || unowned){
         free();
     }
 
@@ -58,12 +70,37 @@ void Vulgine::Memory::Image::allocate(VkImageCreateInfo imageCI, VmaMemoryUsage
 
 }
 
+void Vulgine::Memory::Image::create(VkImageCreateInfo imageCI) {
+    free();
+
+    imageInfo = imageCI;
+
+    VK_CHECK_RESULT(vkCreateImage(GetImpl().device->logicalDevice, &imageCI, nullptr, &image))
+
+    unowned = true;
+}
+
+VkMemoryRequirements Vulgine::Memory::Image::memoryRequirements() const {
+    VkMemoryRequirements memReqs;
+    vkGetImageMemoryRequirements(GetImpl().device->logicalDevice, image, &memReqs);
+    return memReqs;
+}
+
+void Vulgine::Memory::Image::bind(VmaAllocation memory, VkDeviceSize offset) {
+    assert(unowned && "Only images made by create() can be bound to foreign memory");
+
+    VK_CHECK_RESULT(vmaBindImageMemory2(GetImpl().allocator, memory, offset, image, nullptr))
+}
+
 void Vulgine::Memory::Image::free() {
     if(allocated){
         vmaDestroyImage(GetImpl().allocator, image, allocation);
+    } else if(unowned){
+        vkDestroyImage(GetImpl().device->logicalDevice, image, nullptr);
     }
 
     allocated = false;
+    unowned = false;
 
     image = VK_NULL_HANDLE;
 }
@@ -71,6 +108,8 @@ void Vulgine::Memory::Image::free() {
 Vulgine::Memory::Image::~Image() {
     if(allocated){
         vmaDestroyImage(GetImpl().allocator, image, allocation);
+    } else if(unowned){
+        vkDestroyImage(GetImpl().device->logicalDevice, image, nullptr);
     }
 }
 
@@ -164,94 +203,57 @@ void Vulgine::Memory::Image::transitImageLayout(VkImageLayout oldLayout, VkImage
             1, &barrier
     );
 
-    GetImpl().device->flushCommandBuffer(transitCmd, GetImpl().transferQueue, true);
-
-}
-
-void Vulgine::Memory::Image::copyFromBuffer(VkBuffer buffer, uint32_t width, uint32_t height, uint32_t depth) {
-    VkCommandBuffer copyCmd = GetImpl().device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {
-            width,
-            height,
-            depth
-    };
-
-    vkCmdCopyBufferToImage(
-            copyCmd,
-            buffer,
-            image,
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            1,
-            &region
-    );
-
-    GetImpl().device->flushCommandBuffer(copyCmd, GetImpl().transferQueue, true);
+    GetImpl().flushCommandBuffer(transitCmd);
 
 }
 
-void Vulgine::Memory::ImmutableBuffer::create(void *pData, size_t size, VkBufferUsageFlagBits usage) {
+Vulgine::UploadToken Vulgine::Memory::ImmutableBuffer::create(void *pData, size_t size, VkBufferUsageFlagBits usage) {
 
     assert(pData && size && "Invalid data description");
 
-    //vkQueueWaitIdle(GetImpl().transferQueue);
-
     if(allocated)
         free();
 
-    // We will use staging buffer to perform direct memory mapping and the copy it to device local memory
-
-    Buffer stagingBuffer;
-
-    VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, size);
+    VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
     bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    stagingBuffer.allocate(bufferCI, VMA_MEMORY_USAGE_CPU_ONLY);
-
-    bufferCI.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-
-
     // Need to explicitly state that I want device local memory because VMA_MEMORY_USAGE_GPU_ONLY doesn't guarantee it
     // to be so.
 
     allocate(bufferCI, VMA_MEMORY_USAGE_GPU_ONLY, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
 
-    void* mappedData;
+    // data goes through staging memory of the uploader, which submits it along with other uploads
 
-    vmaMapMemory(GetImpl().allocator, stagingBuffer.allocation, &mappedData);
-
-    memcpy(mappedData, pData, size);
-
-    vmaUnmapMemory(GetImpl().allocator, stagingBuffer.allocation);
+    return GetImpl().uploader.upload(*this, usage, pData, size);
+}
 
+void Vulgine::Memory::ImmutableBuffer::free() {
+    if(!allocated)
+        return;
 
-    // Copy from staging buffers
+    // upload batch not submitted yet or frames in flight may still refer to the buffer
 
-    VkCommandBuffer copyCmd = GetImpl().device->createCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+    auto oldBuffer = buffer;
+    auto oldAllocation = allocation;
 
-    VkBufferCopy copyRegion = {};
+    GetImpl().retire([oldBuffer, oldAllocation](){
+        vmaDestroyBuffer(GetImpl().allocator, oldBuffer, oldAllocation);
+    });
 
-    copyRegion.size = size;
-    vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, buffer, 1, &copyRegion);
+    allocated = false;
+    buffer = VK_NULL_HANDLE;
+}
 
-    GetImpl().device->flushCommandBuffer(copyCmd, GetImpl().transferQueue, true);
+void Vulgine::Memory::ImmutableBuffer::replaceWith(ImmutableBuffer &replacement) {
+    free();
 
-    //vkQueueWaitIdle(GetImpl().transferQueue);
-}
+    buffer = replacement.buffer;
+    bufferInfo = replacement.bufferInfo;
+    allocation = replacement.allocation;
+    allocated = replacement.allocated;
 
-void Vulgine::Memory::ImmutableBuffer::free() {
-    Buffer::free();
+    replacement.buffer = VK_NULL_HANDLE;
+    replacement.allocated = false;
 }
 
 void Vulgine::Memory::VertexBuffer::bind(VkCommandBuffer cmdBuffer) {
@@ -268,10 +270,10 @@ void Vulgine::Memory::DynamicBuffer::create(size_t size, VkBufferUsageFlagBits u
 
     assert(size && "Invalid data description");
 
-    if(allocated) {
-        vmaUnmapMemory(GetImpl().allocator, allocation);
+    // free() unmaps memory as well
+
+    if(allocated)
         free();
-    }
 
     dataSize = size;
 
@@ -304,22 +306,26 @@ void Vulgine::Memory::DynamicBuffer::free() {
     Buffer::free();
 }
 
-void Vulgine::Memory::StaticVertexBuffer::create(void *pData, size_t size) {
-    ImmutableBuffer::create(pData, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+Vulgine::UploadToken Vulgine::Memory::StaticVertexBuffer::create(void *pData, size_t size) {
+    return ImmutableBuffer::create(pData, size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 }
 
 void Vulgine::Memory::DynamicVertexBuffer::create(size_t size) {
     DynamicBuffer::create(size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 }
 
-void Vulgine::Memory::StaticIndexBuffer::create(uint32_t *pData, size_t size) {
-    ImmutableBuffer::create((void*)pData, size * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+Vulgine::UploadToken Vulgine::Memory::StaticIndexBuffer::create(uint32_t *pData, size_t size) {
+    return ImmutableBuffer::create((void*)pData, size * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 }
 
 void Vulgine::Memory::DynamicIndexBuffer::create(size_t size) {
     DynamicBuffer::create(size * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
 }
 
+void Vulgine::Memory::IndirectBuffer::create(size_t size) {
+    DynamicBuffer::create(size, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+}
+
 
 void Vulgine::Memory::IndexBuffer::bind(VkCommandBuffer cmdBuffer) {
     vkCmdBindIndexBuffer(cmdBuffer, buffer, 0, VK_INDEX_TYPE_UINT32);
@@ -349,3 +355,324 @@ Vulgine::Memory::StagingBuffer::~StagingBuffer() {
         Buffer::free();
     }
 }
+
+void Vulgine::Memory::StagingRing::create(VkDeviceSize size, VkDeviceSize regionAlignment) {
+    alignment = regionAlignment;
+    capacity = (size + alignment - 1) / alignment * alignment;
+
+    VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(VK_BUFFER_USAGE_TRANSFER_SRC_BIT, capacity);
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    allocate(bufferCI, VMA_MEMORY_USAGE_CPU_ONLY);
+
+    vmaMapMemory(GetImpl().allocator, allocation, &mapped);
+
+    head = 0;
+    tail = 0;
+}
+
+bool Vulgine::Memory::StagingRing::push(const void *data, VkDeviceSize size, VkDeviceSize &offset) {
+    assert(allocated && "Staging ring is not created");
+
+    uint64_t start = (head + alignment - 1) / alignment * alignment;
+
+    if(start % capacity + size > capacity)
+        start = (start / capacity + 1) * capacity;
+
+    if(start + size - tail > capacity)
+        return false;
+
+    offset = start % capacity;
+    head = start + size;
+
+    memcpy((char*)mapped + offset, data, size);
+
+    return true;
+}
+
+void Vulgine::Memory::StagingRing::release(uint64_t position) {
+    tail = std::max(tail, position);
+}
+
+void Vulgine::Memory::StagingRing::free() {
+    if(allocated)
+        vmaUnmapMemory(GetImpl().allocator, allocation);
+    Buffer::free();
+}
+
+Vulgine::Memory::StagingRing::~StagingRing() {
+    if(allocated)
+        vmaUnmapMemory(GetImpl().allocator, allocation);
+}
+
+bool Vulgine::Memory::FreeRanges::take(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset) {
+    for(auto range = ranges.begin(); range != ranges.end(); ++range){
+        auto rangeStart = range->first;
+        auto rangeEnd = range->first + range->second;
+        auto start = (rangeStart + alignment - 1) / alignment * alignment;
+
+        if(start + size > rangeEnd)
+            continue;
+
+        ranges.erase(range);
+
+        // padding before taken range and rest of the range stay free
+
+        if(start != rangeStart)
+            ranges.emplace(rangeStart, start - rangeStart);
+        if(start + size != rangeEnd)
+            ranges.emplace(start + size, rangeEnd - start - size);
+
+        offset = start;
+        return true;
+    }
+    return false;
+}
+
+void Vulgine::Memory::FreeRanges::give(VkDeviceSize offset, VkDeviceSize size) {
+    auto start = offset;
+
+    auto next = ranges.lower_bound(start);
+
+    if(next != ranges.end() && next->first == start + size){
+        size += next->second;
+        next = ranges.erase(next);
+    }
+
+    if(next != ranges.begin()){
+        auto prev = std::prev(next);
+        if(prev->first + prev->second == start){
+            start = prev->first;
+            size += prev->second;
+            ranges.erase(prev);
+        }
+    }
+
+    ranges.emplace(start, size);
+}
+
+void Vulgine::Memory::BufferPool::create(VkBufferUsageFlags bufferUsage, VkDeviceSize defaultBlockSize) {
+    usage = bufferUsage;
+    blockSize = defaultBlockSize;
+}
+
+void Vulgine::Memory::BufferPool::destroy() {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    blocks.clear();
+    regionCount = 0;
+}
+
+Vulgine::Memory::BufferPool::Block &Vulgine::Memory::BufferPool::addBlock(VkDeviceSize size) {
+    auto& block = blocks.emplace_back(std::make_unique<Block>());
+
+    // regions are copied within pool as well, e.g. to gather instances of several meshes
+
+    VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, size);
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    block->buffer.allocate(bufferCI, VMA_MEMORY_USAGE_GPU_ONLY, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    block->size = size;
+    block->freeRanges.give(0, size);
+
+    logger("Buffer pool: new block of " + std::to_string(size / 1024) + " KiB, " + std::to_string(blocks.size()) + " blocks total");
+
+    return *block;
+}
+
+Vulgine::Memory::BufferRegion Vulgine::Memory::BufferPool::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+    assert(alignment && "Invalid region description");
+
+    // nothing to store: region is empty, freeing and writing it are no-ops
+
+    if(size == 0)
+        return {};
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    BufferRegion region{};
+    region.size = size;
+
+    for(uint32_t i = 0; i < blocks.size(); ++i)
+        if(blocks.at(i)->freeRanges.take(size, alignment, region.offset)){
+            region.buffer = blocks.at(i)->buffer.buffer;
+            region.block = i;
+            ++regionCount;
+            return region;
+        }
+
+    // data larger than default block gets block of its own
+
+    auto& block = addBlock(std::max(blockSize, size + alignment));
+
+    block.freeRanges.take(size, alignment, region.offset);
+    region.buffer = block.buffer.buffer;
+    region.block = blocks.size() - 1;
+    ++regionCount;
+
+    return region;
+}
+
+void Vulgine::Memory::BufferPool::free(BufferRegion const& region) {
+    if(!region)
+        return;
+
+    std::lock_guard<std::mutex> lock{mutex};
+
+    blocks.at(region.block)->freeRanges.give(region.offset, region.size);
+
+    --regionCount;
+}
+
+uint32_t Vulgine::Memory::BufferPool::blockCount() const {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    return blocks.size();
+}
+
+VkDeviceSize Vulgine::Memory::BufferPool::capacity() const {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    VkDeviceSize ret = 0;
+
+    for(auto const& block: blocks)
+        ret += block->size;
+
+    return ret;
+}
+
+uint32_t Vulgine::Memory::BufferPool::regions() const {
+    std::lock_guard<std::mutex> lock{mutex};
+
+    return regionCount;
+}
+
+Vulgine::UploadToken Vulgine::Memory::BufferPool::write(BufferRegion const& region, const void *data, VkDeviceSize size) {
+    assert(size <= region.size && "Data doesn't fit into region");
+
+    if(size == 0)
+        return {};
+
+    Block* block;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        block = blocks.at(region.block).get();
+    }
+
+    return GetImpl().uploader.upload(block->buffer, usage, data, size, region.offset);
+}
+
+Vulgine::UploadToken Vulgine::Memory::BufferPool::copy(BufferRegion const& src, BufferRegion const& dst, VkDeviceSize offset) {
+    assert(offset + src.size <= dst.size && "Data doesn't fit into region");
+
+    if(!src)
+        return {};
+
+    Block* srcBlock;
+    Block* dstBlock;
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        srcBlock = blocks.at(src.block).get();
+        dstBlock = blocks.at(dst.block).get();
+    }
+
+    return GetImpl().uploader.copy(srcBlock->buffer, src.offset, dstBlock->buffer, dst.offset + offset, src.size, usage);
+}
+
+void Vulgine::Memory::UniformRing::allocateSections(VkDeviceSize size) {
+    VkBufferCreateInfo bufferCI = initializers::bufferCreateInfo(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, size * sectionCount);
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    allocate(bufferCI, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+    vmaMapMemory(GetImpl().allocator, allocation, &mapped);
+
+    sectionSize = size;
+}
+
+void Vulgine::Memory::UniformRing::create(uint32_t sections, VkDeviceSize size, VkDeviceSize slotAlignment) {
+    assert(sections && size && "Invalid uniform ring description");
+
+    alignment = slotAlignment;
+    sectionCount = sections;
+
+    // section size keeps dynamic offsets aligned as well
+
+    allocateSections((size + alignment - 1) / alignment * alignment);
+
+    freeRanges.clear();
+    freeRanges.give(0, sectionSize);
+    slotCount = 0;
+}
+
+void Vulgine::Memory::UniformRing::destroy() {
+    if(allocated)
+        vmaUnmapMemory(GetImpl().allocator, allocation);
+    Buffer::free();
+
+    freeRanges.clear();
+    sectionSize = 0;
+    slotCount = 0;
+}
+
+void Vulgine::Memory::UniformRing::grow(VkDeviceSize newSectionSize) {
+    auto oldBuffer = buffer;
+    auto oldAllocation = allocation;
+    auto* oldMapped = static_cast<char*>(mapped);
+    auto oldSectionSize = sectionSize;
+
+    // old buffer is still read by frames in flight, so it's not freed by allocate()
+
+    allocated = false;
+
+    allocateSections((newSectionSize + alignment - 1) / alignment * alignment);
+
+    for(uint32_t i = 0; i < sectionCount; ++i)
+        memcpy((char*)mapped + i * sectionSize, oldMapped + i * oldSectionSize, oldSectionSize);
+
+    vmaUnmapMemory(GetImpl().allocator, oldAllocation);
+
+    GetImpl().retire([oldBuffer, oldAllocation](){
+        vmaDestroyBuffer(GetImpl().allocator, oldBuffer, oldAllocation);
+    });
+
+    freeRanges.give(oldSectionSize, sectionSize - oldSectionSize);
+
+    logger("Uniform ring: grown to " + std::to_string(capacity() / 1024) + " KiB");
+}
+
+VkDeviceSize Vulgine::Memory::UniformRing::allocate(VkDeviceSize size) {
+    assert(allocated && "Uniform ring is not created");
+    assert(size && "Invalid slot description");
+
+    VkDeviceSize slot = 0;
+
+    if(!freeRanges.take(size, alignment, slot)){
+        grow(std::max(sectionSize * 2, sectionSize + size + alignment));
+        freeRanges.take(size, alignment, slot);
+    }
+
+    ++slotCount;
+
+    return slot;
+}
+
+void Vulgine::Memory::UniformRing::free(VkDeviceSize slot, VkDeviceSize size) {
+    if(!allocated)
+        return;
+
+    freeRanges.give(slot, size);
+
+    --slotCount;
+}
+
+void Vulgine::Memory::UniformRing::write(uint32_t section, VkDeviceSize slot, const void *data, VkDeviceSize size) {
+    assert(allocated && section < sectionCount && slot + size <= sectionSize && "Write is out of uniform ring bounds");
+
+    memcpy((char*)mapped + sectionOffset(section) + slot, data, size);
+}
+
+Vulgine::Memory::UniformRing::~UniformRing() {
+    if(allocated)
+        vmaUnmapMemory(GetImpl().allocator, allocation);
+}
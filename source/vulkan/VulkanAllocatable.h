@@ -6,7 +6,14 @@
 #define TEST_EXE_VULKANALLOCATABLE_H
 
 #include "vma/vk_mem_alloc.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
 
+namespace Vulgine{
+    struct UploadToken;
+}
 
 namespace Vulgine::Memory{
 
@@ -15,12 +22,16 @@ namespace Vulgine::Memory{
         VmaAllocation allocation;
         bool allocated = false;
 
+        /** device memory taken by allocation, 0 if there is none */
+        VkDeviceSize allocationSize() const;
+
         virtual ~Allocatable() = default;
     };
 
 
     struct Buffer : public Allocatable {
         VkBuffer buffer;
+        VkBufferCreateInfo bufferInfo;
 
         void allocate(VkBufferCreateInfo bufferCI, VmaMemoryUsage memoryUsageFlags,
                       VmaAllocationCreateFlags allocFlags = 0,
@@ -36,17 +47,27 @@ namespace Vulgine::Memory{
         VkImage image;
         VkImageCreateInfo imageInfo;
 
+        // image was made by create(), so its memory (if bound) is not owned by it
+
+        bool unowned = false;
+
         void allocate(VkImageCreateInfo imageCI, VmaMemoryUsage memoryUsageFlags,
                       VmaAllocationCreateFlags allocFlags = 0,
                       VkMemoryPropertyFlags reqFlags = 0,
                       VkMemoryPropertyFlags prefFlags = 0);
 
+        /** creates image without memory. It must be bound with bind() before use */
+        void create(VkImageCreateInfo imageCI);
+
+        VkMemoryRequirements memoryRequirements() const;
+
+        /** binds image made by create() to part of memory it doesn't own (e.g. shared with other images) */
+        void bind(VmaAllocation memory, VkDeviceSize offset);
+
         void free();
 
         void transitImageLayout(VkImageLayout oldLayout, VkImageLayout newLayout);
 
-        void copyFromBuffer(VkBuffer buffer, uint32_t width, uint32_t height, uint32_t depth = 1);
-
         virtual VkImageView createImageView() const;
 
         ~Image() override;
@@ -63,6 +84,40 @@ namespace Vulgine::Memory{
         ~StagingBuffer() override;
     };
 
+    /**
+     *  @StagingRing - persistently mapped staging memory suballocated in ring order. Regions are
+     *  released in the order they were taken, by position ring head had after the last of them.
+     */
+
+    class StagingRing final: public Buffer{
+        void* mapped = nullptr;
+        VkDeviceSize capacity = 0;
+        VkDeviceSize alignment = 1;
+
+        // Positions grow since creation and never wrap, physical offset is position % capacity.
+        // Region crossing the end of the ring is moved to its beginning.
+
+        uint64_t head = 0;
+        uint64_t tail = 0;
+    public:
+        void create(VkDeviceSize size, VkDeviceSize regionAlignment);
+
+        /** copies data to free region and returns its offset. Returns false if there is no space left */
+        bool push(const void* data, VkDeviceSize size, VkDeviceSize& offset);
+
+        /** head position, regions pushed so far end before it */
+        uint64_t position() const { return head;};
+
+        /** frees every region ending before given position */
+        void release(uint64_t position);
+
+        VkDeviceSize size() const { return capacity;};
+
+        void free() override;
+
+        ~StagingRing() override;
+    };
+
     /**
      *
      *
@@ -74,8 +129,12 @@ namespace Vulgine::Memory{
      */
 
     struct ImmutableBuffer: virtual public Buffer{
-        void create(void* pData, size_t size, VkBufferUsageFlagBits usage);
+        /** data is copied by uploader asynchronously, returned token tells when it's done */
+        UploadToken create(void* pData, size_t size, VkBufferUsageFlagBits usage);
         void free() override;
+
+        /** retires own buffer and takes over the one of replacement, which is left empty */
+        void replaceWith(ImmutableBuffer& replacement);
     };
 
     /**
@@ -98,6 +157,8 @@ namespace Vulgine::Memory{
 
         void push(void* data, size_t size = 0, size_t offset = 0);
 
+        size_t capacity() const { return dataSize;};
+
         void free() override;
 
         ~DynamicBuffer() override;
@@ -116,7 +177,7 @@ namespace Vulgine::Memory{
 
     struct StaticVertexBuffer: public ImmutableBuffer, public VertexBuffer{
 
-        void create(void* pData, size_t size);
+        UploadToken create(void* pData, size_t size);
 
     };
 
@@ -128,7 +189,7 @@ namespace Vulgine::Memory{
 
     struct StaticIndexBuffer: public IndexBuffer, public ImmutableBuffer{
 
-        void create(uint32_t * pData, size_t size);
+        UploadToken create(uint32_t * pData, size_t size);
 
 
     };
@@ -139,6 +200,133 @@ namespace Vulgine::Memory{
 
     };
 
+    /** draw parameters read by indirect draw commands, written by CPU each time draws are compiled */
+
+    struct IndirectBuffer: public DynamicBuffer{
+
+        void create(size_t size);
+
+    };
+
+    /** free ranges of suballocated memory by offset, neighbouring ranges are always merged */
+
+    class FreeRanges{
+        std::map<VkDeviceSize, VkDeviceSize> ranges;
+    public:
+        /** takes first range fitting size bytes at offset multiple of alignment (not necessarily power of 2) */
+        bool take(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+
+        void give(VkDeviceSize offset, VkDeviceSize size);
+
+        void clear() { ranges.clear();};
+    };
+
+    /** range of buffer pool block. Block buffer stays the same while region is alive */
+
+    struct BufferRegion{
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t block = 0;
+
+        explicit operator bool() const { return buffer != VK_NULL_HANDLE;};
+    };
+
+    /**
+     *
+     *  @BufferPool - few large device local buffers, suballocated by first fit free list.
+     *  Used for static data of many objects (e.g. mesh vertices), so that they share buffer
+     *  bindings and don't take VMA allocation each.
+     *
+     */
+
+    class BufferPool{
+        struct Block{
+            Buffer buffer;
+            VkDeviceSize size = 0;
+            FreeRanges freeRanges;
+        };
+
+        std::vector<std::unique_ptr<Block>> blocks;
+
+        VkBufferUsageFlags usage = 0;
+        VkDeviceSize blockSize = 0;
+
+        uint32_t regionCount = 0;
+
+        // regions may be requested while worker threads record command buffers
+
+        mutable std::mutex mutex;
+
+        Block& addBlock(VkDeviceSize size);
+
+    public:
+        void create(VkBufferUsageFlags bufferUsage, VkDeviceSize defaultBlockSize);
+        void destroy();
+
+        /** takes region with offset multiple of alignment (not necessarily power of 2). Empty region is returned for size 0 */
+        BufferRegion allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+        /** gives region back right away, so it must not be used by GPU anymore */
+        void free(BufferRegion const& region);
+
+        /** copies data to the region through uploader */
+        UploadToken write(BufferRegion const& region, const void* data, VkDeviceSize size);
+
+        /** copies whole src region to dst region at offset through uploader, after data written so far */
+        UploadToken copy(BufferRegion const& src, BufferRegion const& dst, VkDeviceSize offset);
+
+        uint32_t blockCount() const;
+        VkDeviceSize capacity() const;
+        uint32_t regions() const;
+    };
+
+    /**
+     *  @UniformRing - persistently mapped buffer holding frequently updated uniform data of many objects.
+     *  It's split into equal sections, one per swap chain image, and every object takes the same slot
+     *  in each of them. Descriptors refer to slot of the first section, section of image is selected
+     *  by dynamic offset when set is bound, so descriptors and command buffers don't depend on data.
+     *
+     *  Used by main thread only.
+     */
+
+    class UniformRing final: public Buffer{
+        void* mapped = nullptr;
+        VkDeviceSize sectionSize = 0;
+        uint32_t sectionCount = 0;
+        VkDeviceSize alignment = 1;
+
+        // free slots of a section, they are the same in every section
+
+        FreeRanges freeRanges;
+
+        uint32_t slotCount = 0;
+
+        void allocateSections(VkDeviceSize size);
+
+        /** moves data to larger buffer, old one is retired */
+        void grow(VkDeviceSize newSectionSize);
+    public:
+        void create(uint32_t sections, VkDeviceSize size, VkDeviceSize slotAlignment);
+        void destroy();
+
+        /** takes slot of size bytes in every section. If there is no space left, ring grows,
+         *  which replaces its buffer and moves sections */
+        VkDeviceSize allocate(VkDeviceSize size);
+
+        /** gives slot back right away, so it must not be used by GPU anymore */
+        void free(VkDeviceSize slot, VkDeviceSize size);
+
+        void write(uint32_t section, VkDeviceSize slot, const void* data, VkDeviceSize size);
+
+        /** dynamic offset selecting the section */
+        uint32_t sectionOffset(uint32_t section) const { return section * sectionSize;};
+
+        VkDeviceSize capacity() const { return sectionSize * sectionCount;};
+        uint32_t slots() const { return slotCount;};
+
+        ~UniformRing() override;
+    };
 
 }
 
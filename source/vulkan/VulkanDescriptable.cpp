@@ -9,6 +9,7 @@
 void Vulgine::CombinedImageSampler::setupDescriptor() {
     descriptor.imageView = image->createImageView();
     descriptor.imageLayout = claimedLayout;
+    viewedImage = image->image;
     descriptor.sampler = sampler;
 }
 
@@ -29,14 +30,19 @@ VkWriteDescriptorSet Vulgine::CombinedImageSampler::write(int binding) {
     return ret;
 }
 
-Vulgine::DUniformBuffer::DUniformBuffer(Memory::Buffer* buf): buffer(buf), Descriptable(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER) {
+Vulgine::DUniformBuffer::DUniformBuffer(Memory::Buffer* buf): buffer(buf), Descriptable(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+    descriptor.offset = 0;
+    descriptor.range = VK_WHOLE_SIZE;
+}
 
+Vulgine::DUniformBuffer::DUniformBuffer(Memory::UniformRing *uniformRing, VkDeviceSize slot, VkDeviceSize size): buffer(uniformRing), ring(uniformRing),
+                                                                                                                 Descriptable(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC) {
+    descriptor.offset = slot;
+    descriptor.range = size;
 }
 
 void Vulgine::DUniformBuffer::setupDescriptor() {
     descriptor.buffer = buffer->buffer;
-    descriptor.offset = 0;
-    descriptor.range = VK_WHOLE_SIZE;
 }
 
 void Vulgine::DUniformBuffer::destroyDescriptor() {
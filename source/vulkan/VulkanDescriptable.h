@@ -18,6 +18,10 @@ namespace Vulgine{
         virtual VkWriteDescriptorSet write(int binding) = 0;
         virtual void setupDescriptor() = 0;
         virtual void destroyDescriptor() = 0;
+        /** resource was replaced since descriptor was set up, so set must be rewritten */
+        virtual bool outdated() const { return false;};
+        /** offset added to descriptor's own one when set is bound for swap chain image, dynamic descriptors only */
+        virtual uint32_t dynamicOffset(uint32_t image) const { return 0;};
         virtual ~Descriptable() = default;
     };
 
@@ -32,20 +36,30 @@ namespace Vulgine{
 
     struct CombinedImageSampler: public DImage{
         VkSampler sampler;
+        // image view of descriptor was created for
+        VkImage viewedImage = VK_NULL_HANDLE;
         CombinedImageSampler(Memory::Image* img, VkSampler sampler);
         VkWriteDescriptorSet write(int binding) override;
         void setupDescriptor() override;
         void destroyDescriptor() override;
+        bool outdated() const override { return viewedImage != image->image;};
         ~CombinedImageSampler() override;
     };
 
+    /** Uniform buffers are always dynamic descriptors, so pipeline layouts don't depend on kind of
+     *  buffer bound. Static buffer is bound at offset 0, slot of uniform ring at section of the image */
+
     struct DUniformBuffer: public Descriptable{
         Memory::Buffer* buffer;
+        Memory::UniformRing* ring = nullptr;
         VkDescriptorBufferInfo descriptor{};
         explicit DUniformBuffer(Memory::Buffer* buf);
+        DUniformBuffer(Memory::UniformRing* uniformRing, VkDeviceSize slot, VkDeviceSize size);
         VkWriteDescriptorSet write(int binding) override;
         void setupDescriptor() override;
         void destroyDescriptor() override;
+        bool outdated() const override { return descriptor.buffer != buffer->buffer;};
+        uint32_t dynamicOffset(uint32_t image) const override { return ring ? ring->sectionOffset(image) : 0;};
     };
 
     struct DInputAttachment: public DImage {
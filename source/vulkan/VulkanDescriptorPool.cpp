@@ -125,8 +125,9 @@ void Vulgine::DescriptorPool::reset() {
     pools.resize(1);
 }
 
-void Vulgine::DescriptorPool::bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint pipelineType, VkPipelineLayout layout, uint32_t set, uint32_t id) const{
-    vkCmdBindDescriptorSets(cmdBuffer, pipelineType, layout, set, 1, &sets.at(id), 0, nullptr);
+void Vulgine::DescriptorPool::bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint pipelineType, VkPipelineLayout layout, uint32_t set, uint32_t id,
+                                   uint32_t dynamicOffsetCount, const uint32_t* dynamicOffsets) const{
+    vkCmdBindDescriptorSets(cmdBuffer, pipelineType, layout, set, 1, &sets.at(id), dynamicOffsetCount, dynamicOffsets);
 }
 
 void Vulgine::DescriptorPool::updateDescriptor(uint32_t id, std::vector<VkWriteDescriptorSet> writes) {
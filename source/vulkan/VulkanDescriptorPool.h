@@ -31,7 +31,9 @@ namespace Vulgine{
 
         uint32_t allocateSet(const VkDescriptorSetLayoutBinding*, uint32_t bindingCount);
 
-        void bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint pipelineType, VkPipelineLayout layout, uint32_t set, uint32_t id) const;
+        /** dynamic offsets are given in binding order of set's dynamic descriptors */
+        void bind(VkCommandBuffer cmdBuffer, VkPipelineBindPoint pipelineType, VkPipelineLayout layout, uint32_t set, uint32_t id,
+                  uint32_t dynamicOffsetCount = 0, const uint32_t* dynamicOffsets = nullptr) const;
 
         void updateDescriptor(uint32_t id, std::vector<VkWriteDescriptorSet> writes);
 
@@ -96,19 +96,7 @@ void Vulgine::GUI::init(int numberOfFrames) {
     viewInfo.subresourceRange.layerCount = 1;
     VK_CHECK_RESULT(vkCreateImageView(GetImpl().device->logicalDevice, &viewInfo, nullptr, &fontView));
 
-    Memory::StagingBuffer buffer;
-
-    buffer.create(uploadSize);
-
-    buffer.fill(fontData);
-
-    fontImage.transitImageLayout(VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-
-    fontImage.copyFromBuffer(buffer.buffer, texWidth, texHeight);
-
-    fontImage.transitImageLayout(VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-
-    buffer.free();
+    GetImpl().uploader.upload(fontImage, fontData, uploadSize);
 
     sampler = GetImpl().samplers.getImpl(GetImpl().initNewSampler()->id());
     sampler->create();
@@ -151,6 +139,7 @@ void Vulgine::GUI::init(int numberOfFrames) {
 
     vertexCounts.resize(numberOfFrames, 0);
     indexCounts.resize(numberOfFrames,0);
+    recordedSignatures.resize(numberOfFrames, 0);
 }
 
 void Vulgine::GUI::destroy() {
@@ -179,6 +168,10 @@ void Vulgine::GUI::destroy() {
 
 }
 
+void Vulgine::GUI::releaseObjects() {
+    sampler.reset();
+}
+
 void Vulgine::GUI::preparePipeline(VkRenderPass renderPass) {
 
     if(pipeline != VK_NULL_HANDLE)
@@ -311,17 +304,20 @@ bool Vulgine::GUI::update(int currentFrame) {
     auto& indexCount = indexCounts.at(currentFrame);
 
     ImDrawData* imDrawData = ImGui::GetDrawData();
-    bool updateCmdBuffers = false;
 
     if (!imDrawData) { return false; };
 
+    // Draw commands are baked into command buffer, so it must be re-recorded whenever they change
+
+    bool updateCmdBuffers = drawDataSignature(imDrawData) != recordedSignatures.at(currentFrame);
+
     // Note: Alignment is done inside buffer creation
     VkDeviceSize vertexBufferSize = imDrawData->TotalVtxCount * sizeof(ImDrawVert);
     VkDeviceSize indexBufferSize = imDrawData->TotalIdxCount * sizeof(ImDrawIdx);
 
     // Update buffers only if vertex or index count has been changed compared to current buffer size
     if ((vertexBufferSize == 0) || (indexBufferSize == 0)) {
-        return true;
+        return updateCmdBuffers;
     }
 
     // Vertex buffer
@@ -371,6 +367,8 @@ void Vulgine::GUI::draw(VkCommandBuffer commandBuffer, int currentFrame) {
     int32_t vertexOffset = 0;
     int32_t indexOffset = 0;
 
+    recordedSignatures.at(currentFrame) = imDrawData ? drawDataSignature(imDrawData) : 0;
+
     if ((!imDrawData) || (imDrawData->CmdListsCount == 0)) {
         return;
     }
@@ -473,4 +471,45 @@ void Vulgine::GUI::deleteTexturedImage(Memory::Image *image) {
     vkDestroyImageView(GetImpl().device->logicalDevice, elem.first, nullptr);
 
     descriptorSets.erase(image);
+
+    // recorded command buffers may still refer to freed descriptor set
+
+    GetImpl().cmdBuffersOutdated = true;
+}
+
+void Vulgine::GUI::refreshTexturedImage(Memory::Image *image) {
+    if(!descriptorSets.count(image))
+        return;
+
+    deleteTexturedImage(image);
+    addTexturedImage(image);
+}
+
+size_t Vulgine::GUI::drawDataSignature(ImDrawData *drawData) {
+    size_t seed = 0;
+    auto combine = [&seed](size_t value){
+        seed ^= value + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+    };
+
+    combine(drawData->CmdListsCount);
+    combine(drawData->TotalVtxCount);
+    combine(drawData->TotalIdxCount);
+    combine(std::hash<float>{}(drawData->DisplaySize.x));
+    combine(std::hash<float>{}(drawData->DisplaySize.y));
+
+    for (int32_t i = 0; i < drawData->CmdListsCount; i++) {
+        const ImDrawList* cmd_list = drawData->CmdLists[i];
+        combine(cmd_list->VtxBuffer.Size);
+        for (int32_t j = 0; j < cmd_list->CmdBuffer.Size; j++) {
+            const ImDrawCmd* pcmd = &cmd_list->CmdBuffer[j];
+            combine(pcmd->ElemCount);
+            combine(std::hash<void*>{}(pcmd->GetTexID()));
+            combine(std::hash<float>{}(pcmd->ClipRect.x));
+            combine(std::hash<float>{}(pcmd->ClipRect.y));
+            combine(std::hash<float>{}(pcmd->ClipRect.z));
+            combine(std::hash<float>{}(pcmd->ClipRect.w));
+        }
+    }
+
+    return seed;
 }
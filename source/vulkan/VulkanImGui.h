@@ -30,6 +30,12 @@ namespace Vulgine{
         std::vector<int32_t> vertexCounts;
         std::vector<int32_t> indexCounts;
 
+        /** signature of ImGui draw data recorded into each frame's command buffer */
+
+        std::vector<size_t> recordedSignatures;
+
+        static size_t drawDataSignature(ImDrawData* drawData);
+
 
         VkDescriptorPool descriptorPool;
 
@@ -70,6 +76,8 @@ namespace Vulgine{
 
         void preparePipeline(VkRenderPass renderPass);
 
+        /** pushes new draw data and returns true if command buffer of this frame must be re-recorded */
+
         bool update(int currentFrame);
 
         void draw(VkCommandBuffer commandBuffer, int currentFrame);
@@ -80,6 +88,12 @@ namespace Vulgine{
 
         void deleteTexturedImage(Memory::Image* image);
 
+        /** recreates descriptor of image whose handle was replaced. GPU must not use the old one anymore */
+        void refreshTexturedImage(Memory::Image* image);
+
+        /** releases engine objects held by GUI, so they are destroyed before engine resources they depend on */
+        void releaseObjects();
+
         void destroy();
     };
 }
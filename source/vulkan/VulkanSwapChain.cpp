@@ -35,7 +35,11 @@ namespace Vulgine {
     }
 
     void VulkanSwapChain::initSurface(GLFWwindow *window) {
+        // builds without window support run headless only, surface is never requested there
+
+#ifndef VULGINE_NO_WINDOW
         VK_CHECK_RESULT(glfwCreateWindowSurface(instance, window, nullptr, &surface))
+#endif
         // Get available queue family properties
         uint32_t queueCount;
         vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueCount, NULL);